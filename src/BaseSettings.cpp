@@ -4,17 +4,25 @@
  *    in JSON format.
  *
  * NOTES:
+ * o Settings are parsed directly from the file through a small buffer. If the
+ *   settings object declares its fields (see BaseSerializer::visitFields), a
+ *   filter drops any other keys (e.g. left over from an older version) so they
+ *   aren't kept in the document. Otherwise the whole file is parsed.
  *
  */
 
 //--------------- Begin:  Includes ---------------------------------------------
 //                                  Core Libraries
+#include <algorithm>
+#include <memory>
+#include <vector>
 #include <Arduino.h>
 #include <ESP_FS.h>
 //                                  Third Party Libraries
 #include <ArduinoLog.h>
 #include <ArduinoJson.h>
 //                                  Personal Libraries
+#include <GenericESP.h>
 //                                  App Libraries and Includes
 #include "BaseSettings.h"
 //--------------- End:    Includes ---------------------------------------------
@@ -50,6 +58,95 @@ void BaseSerializer::fromJSON(const String& json) {
 // ----- BaseSerializer Implamentation
 //
 
+namespace {
+  // Reads a file a buffer at a time for the parser rather than a byte at a
+  // time, noting the lowest free heap seen as the document is filled in
+  class BufferedFileReader {
+  public:
+    BufferedFileReader(File& theFile) : file(theFile) { }
+
+    int read() {
+      if (next == end && !fill()) return -1;
+      return (uint8_t)buffer[next++];
+    }
+
+    size_t readBytes(char* dest, size_t length) {
+      size_t n = 0;
+      while (n < length && (next < end || fill())) {
+        size_t chunk = std::min(length - n, end - next);
+        memcpy(dest + n, buffer + next, chunk);
+        next += chunk;
+        n += chunk;
+      }
+      return n;
+    }
+
+    uint32_t lowestHeap = UINT32_MAX;
+
+  private:
+    bool fill() {
+      lowestHeap = std::min(lowestHeap, (uint32_t)GenericESP::getFreeHeap());
+      int n = file.read(reinterpret_cast<uint8_t*>(buffer), sizeof(buffer));
+      next = 0;
+      end = (n > 0) ? n : 0;
+      return end > 0;
+    }
+
+    File& file;
+    char buffer[128];
+    size_t next = 0;
+    size_t end = 0;
+  };
+
+  // Gathers the names of the fields a settings object presents to visitors
+  class FieldNames : public FieldVisitor {
+  public:
+    void visit(const __FlashStringHelper* name, bool&) override { add(name); }
+    void visit(const __FlashStringHelper* name, long&) override { add(name); }
+    void visit(const __FlashStringHelper* name, float&) override { add(name); }
+    void visit(const __FlashStringHelper* name, String&) override { add(name); }
+    using FieldVisitor::visit;
+
+    std::vector<String> names;
+
+  private:
+    void add(const __FlashStringHelper* name) { names.push_back(String(name)); }
+  };
+
+  // A filter that keeps the fields the settings object declares (through
+  // visitFields), plus the keys toJSON() writes and the version, and drops
+  // anything else (e.g. left over from an older version). Nested values under
+  // those keys are kept whole. The declared fields don't depend on the current
+  // state, so a value that toJSON() only writes conditionally isn't dropped.
+  // @param lowestHeap  Lowered to the free heap while the filter is built
+  // @return The filter, or nullptr if the object declares no fields, in which
+  //         case nothing can safely be dropped
+  DynamicJsonDocument* newReadFilter(BaseSerializer& settings, size_t capacity, uint32_t& lowestHeap) {
+    FieldNames declared;
+    settings.visitFields(declared);
+    if (declared.names.empty()) return nullptr;
+
+    DynamicJsonDocument current(capacity);
+    settings.toJSON(current);
+    lowestHeap = std::min(lowestHeap, (uint32_t)GenericESP::getFreeHeap());
+    JsonObject written = current.as<JsonObject>();
+
+    size_t nFields = declared.names.size() + 1;
+    size_t nameBytes = sizeof("version");
+    for (const String& name : declared.names) nameBytes += name.length() + 1;
+    for (JsonPair field : written) {
+      nFields++;
+      nameBytes += strlen(field.key().c_str()) + 1;
+    }
+    DynamicJsonDocument* filter = new DynamicJsonDocument(JSON_OBJECT_SIZE(nFields) + nameBytes);
+    for (const String& name : declared.names) (*filter)[name] = true;
+    // Keys are copied since current is about to be freed
+    for (JsonPair field : written) (*filter)[String(field.key().c_str())] = true;
+    (*filter)["version"] = true;
+    return filter;
+  }
+}
+
 BaseSettings::BaseSettings() { }
 
 void BaseSettings::init(const String& _filePath) {
@@ -76,12 +173,20 @@ bool BaseSettings::read() {
     return false;
   }
 
-  std::unique_ptr<char[]> buf(new char[size]);
-  settingsFile.readBytes(buf.get(), size);
-  settingsFile.close();
+  uint32_t startTime = millis();
+  uint32_t heapBefore = GenericESP::getFreeHeap();
 
+  uint32_t heapLow = heapBefore;
+  std::unique_ptr<DynamicJsonDocument> filter(newReadFilter(*this, maxFileSize, heapLow));
   DynamicJsonDocument doc(maxFileSize);
-  auto error = deserializeJson(doc, buf.get());
+  BufferedFileReader reader(settingsFile);
+  reader.lowestHeap = heapLow;
+  DeserializationError error = filter ?
+      deserializeJson(doc, reader, DeserializationOption::Filter(*filter)) :
+      deserializeJson(doc, reader);
+  heapLow = std::min(reader.lowestHeap, (uint32_t)GenericESP::getFreeHeap());
+  filter.reset();
+  settingsFile.close();
   if (error) {
     Log.warning(
       F("Failed to parse %s, using default values: %s"), filePath.c_str(), error.c_str());
@@ -99,9 +204,11 @@ bool BaseSettings::read() {
   }
 
   fromJSON(doc);
-  doc.shrinkToFit();
-  
-  Log.trace(F("%s: Settings successfully read"), filePath.c_str());
+  heapLow = std::min(heapLow, (uint32_t)GenericESP::getFreeHeap());
+
+  Log.trace(
+    F("%s: Settings successfully read in %dms. Heap: %d before, %d at lowest (largest block %d)"),
+    filePath.c_str(), millis() - startTime, heapBefore, heapLow, GenericESP::getMaxFreeBlockSize());
   return true;
 }
 
@@ -113,7 +220,11 @@ DynamicJsonDocument *BaseSettings::asJSON() {
   return doc;
 }
 
+uint32_t BaseSettings::_generation = 0;
+
 bool BaseSettings::write() {
+  changed();
+
   DynamicJsonDocument doc(maxFileSize);
 
   doc["version"] = version;
@@ -7,8 +7,66 @@
 #ifndef BaseSettings_h
 #define BaseSettings_h
 
+#include <algorithm>
+#include <climits>
+#include <limits>
+#include <type_traits>
 #include <ArduinoJson.h>
 
+/*
+ * A FieldVisitor is presented with each field of a settings object in turn
+ * (see BaseSerializer::visitFields). It may read the value of the field or
+ * replace it. Integer fields of any size are presented as a long and floating
+ * point fields as a float. Visitors that replace values must keep integers
+ * within the range given for the field, which defaults to the range of its type.
+ */
+class FieldVisitor {
+public:
+  virtual ~FieldVisitor() { }
+
+  virtual void visit(const __FlashStringHelper* name, bool& value) = 0;
+  virtual void visit(const __FlashStringHelper* name, long& value) = 0;
+  virtual void visit(const __FlashStringHelper* name, float& value) = 0;
+  virtual void visit(const __FlashStringHelper* name, String& value) = 0;
+
+  // An integer field whose value must be in [min, max]
+  virtual void visit(const __FlashStringHelper* name, long& value, long min, long max) {
+    visit(name, value);
+  }
+
+  // A field that is never reported, e.g. a password. It may still be replaced.
+  virtual void visitSecret(const __FlashStringHelper* name, String& value) {
+    visit(name, value);
+  }
+
+  template<typename T>
+  typename std::enable_if<
+      std::is_integral<T>::value && !std::is_same<T, bool>::value && !std::is_same<T, long>::value>::type
+  visit(const __FlashStringHelper* name, T& value, long min = lowest<T>(), long max = highest<T>()) {
+    long l = value;
+    visit(name, l, min, max);
+    value = (T)l;
+  }
+
+  template<typename T>
+  typename std::enable_if<
+      std::is_floating_point<T>::value && !std::is_same<T, float>::value>::type
+  visit(const __FlashStringHelper* name, T& value) {
+    float f = value;
+    visit(name, f);
+    value = f;
+  }
+
+private:
+  // The range of T, limited to what a long can hold
+  template<typename T> static long lowest() {
+    return (long)std::max<long long>(std::numeric_limits<T>::min(), LONG_MIN);
+  }
+  template<typename T> static long highest() {
+    return (long)std::min<unsigned long long>(std::numeric_limits<T>::max(), LONG_MAX);
+  }
+};
+
 class BaseSerializer {
 public:
   // Must be implemented by subclasses
@@ -18,6 +76,11 @@ public:
   // May be implemented by subclasses
   virtual void logSettings() { };
 
+  // Present each field to the visitor so that fields can be read or updated
+  // individually without building a JsonDocument (e.g. by the settings API).
+  // Subclasses that don't implement this present no fields.
+  virtual void visitFields(FieldVisitor& v) { };
+
   // Implemented in terms of functions given above
   void fromJSON(const String& json);
   void toJSON(Stream& s);
@@ -47,11 +110,22 @@ public:
    *          holds the settings as JSON.
    */
   DynamicJsonDocument *asJSON();
+
+  /*
+   * A count that changes whenever any settings are written or the configuration
+   * otherwise changes. Anything derived from the settings (e.g. a rendered page)
+   * is stale if the generation has changed since it was derived.
+   */
+  static uint32_t generation() { return _generation; }
+  static void changed() { _generation++; }
   
 protected:
   static const uint32_t InvalidVersion = 0x0000;
   // ----- State
   uint32_t version;
   String   filePath;
+
+private:
+  static uint32_t _generation;
 };
 #endif // BaseSettings_h
\ No newline at end of file
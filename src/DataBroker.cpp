@@ -7,6 +7,9 @@
 
 //--------------- Begin:  Includes ---------------------------------------------
 //                                  Core Libraries
+#include <algorithm>
+#include <array>
+#include <vector>
 //                                  Third Party Libraries
 #include <ArduinoLog.h>
 #include <TimeLib.h>
@@ -20,87 +23,438 @@
 namespace DataBroker {
 
   namespace Mappings {
-    using Mapper = struct {
+    using Entry = struct {
       char prefix;
-      Basics::ReferenceMapper map;
+      Mapper map;                 // For mappers registered without a key table
+      KeyRecognizer recognizes;   // Optional, for those same mappers
+      IdMapper mapId;             // For mappers registered with a key table...
+      TypedMapper mapTyped;       // ...either one of these
+      const char* const* keys;
+      uint8_t nKeys;
+      std::vector<String> interned; // Subkeys resolved for a mapper without a key table
+      uint32_t ttl = 0;           // Cache policy: 0 and no version -> not cached
+      VersionSource version;
     };
 
     constexpr uint8_t MaxMappers = 8;
     uint8_t nMappers = 0;
-    std::array<Mapper, MaxMappers> mappers;
+    std::array<Entry, MaxMappers> mappers;
+    // Indexed by prefix character. Holds 1 + the index of the prefix's
+    // mapper in mappers, or 0 if the prefix has no mapper.
+    uint8_t byPrefix[128] = {0};
 
-    Mapper* findMapper(char prefix) {
-      for (auto& mapper: mappers) {
-        if (mapper.prefix == prefix) return &mapper;
-      }
-      return NULL;
+    Entry* findMapper(char prefix) {
+      uint8_t p = prefix;
+      if (p >= sizeof(byPrefix) || byPrefix[p] == 0) return NULL;
+      return &mappers[byPrefix[p] - 1];
     }
 
-    bool addMapper(Basics::ReferenceMapper map, char prefix) {
+    Entry* addMapper(char prefix) {
       if (nMappers == MaxMappers) {
         Log.warning("DataBroker::registerMapper: No space remains for more mappers");
-        return false;
+        return NULL;
+      }
+      if ((uint8_t)prefix >= sizeof(byPrefix)) {
+        Log.warning("DataBroker::registerMapper: %c is not a valid prefix", prefix);
+        return NULL;
       }
 
-      Mapper* m = findMapper(prefix);
+      Entry* m = findMapper(prefix);
       if (m != NULL) {
         Log.warning("DataBroker::registerMapper: mapper for prefix %c was already registered", prefix);
-        return false;
+        return NULL;
       }
-      mappers[nMappers++] = {prefix, map};
+      m = &mappers[nMappers++];
+      m->prefix = prefix;
+      byPrefix[(uint8_t)prefix] = nMappers;
+
+      return m;
+    }
 
-      return true;
+    // @return The id of subkey in m's key table, or -1 if it isn't there
+    int findId(const Entry* m, const Subkey& subkey) {
+      for (uint8_t id = 0; id < m->nKeys; id++) {
+        if (subkey.equals(m->keys[id])) return id;
+      }
+      return -1;
     }
 
-    void performMapping(char prefix, const String& key, String& value) {
-      Mapper* m = findMapper(prefix);
+    Handle resolve(char prefix, const Subkey& subkey);
+
+    void performMapping(char prefix, const Subkey& subkey, String& value) {
+      Entry* m = findMapper(prefix);
       if (m == NULL) {
-        Log.warning("DataBroker::map: No mapper found for key %s", key.c_str());
+        Log.warning("DataBroker::map: No mapper found for prefix %c", prefix);
         return;
       }
-      m->map(key, value);
+      if (m->map && !(m->ttl || m->version)) {
+        m->map(subkey, value);
+      } else {
+        // Mappers with key tables, and cached values, are mapped by handle
+        Handle h = resolve(prefix, subkey);
+        if (h.valid()) map(h, value);
+        else if (m->map) m->map(subkey, value);   // Not cached, e.g. too many keys
+      }
+    }
+
+    Handle resolve(char prefix, const Subkey& subkey) {
+      Handle h;
+      Entry* m = findMapper(prefix);
+      if (m == NULL) return h;
+
+      int id = -1;
+      if (m->keys) {
+        id = findId(m, subkey);
+      } else {
+        // The broker chooses ids for mappers that don't have a key table
+        for (size_t i = 0; i < m->interned.size(); i++) {
+          if (subkey.equals(m->interned[i].c_str())) { id = i; break; }
+        }
+        if (id < 0) {
+          // Keys often come from requests, so only remember those that the
+          // mapper recognizes, and only so many of them. A key is recognized
+          // even if it has no value yet (e.g. before a sensor's first reading).
+          if (m->recognizes && !m->recognizes(subkey)) return h;
+          if (m->interned.size() == MaxInternedKeys) {
+            Log.warning("DataBroker::resolve: Too many keys for prefix %c", prefix);
+            return h;
+          }
+          id = m->interned.size();
+          m->interned.push_back(subkey.toString());
+        }
+      }
+      if (id < 0) return h;
+
+      h.mapper = byPrefix[(uint8_t)prefix];
+      h.id = id;
+      return h;
     }
   } // ----- END: Databroker::Mappings namespace
 
 
+  namespace Cache {
+    struct Value {
+      Handle handle;
+      uint32_t stamp;   // When it was cached (ttl) or the version it was cached at
+      String value;
+    };
+    std::vector<Value> values;  // Most recently used first
+
+    // Append the value of h to value from the cache, refreshing it first if it is stale
+    void map(const Mappings::Entry& m, Handle h, std::function<void(String&)> compute, String& value) {
+      uint32_t stamp = m.version ? m.version() : millis();
+      auto it = values.begin();
+      while (it != values.end() && (it->handle.mapper != h.mapper || it->handle.id != h.id)) ++it;
+
+      if (it != values.end()) {
+        bool current = m.version ? (it->stamp == stamp) : (stamp - it->stamp < m.ttl);
+        if (!current) {
+          it->value = "";
+          compute(it->value);
+          it->stamp = stamp;
+        }
+        std::rotate(values.begin(), it, it + 1);
+      } else {
+        if (values.size() == MaxCachedValues) values.pop_back();
+        values.insert(values.begin(), {h, stamp, String()});
+        compute(values.front().value);
+      }
+      value += values.front().value;
+    }
+
+    void invalidate(Handle h) {
+      auto it = std::find_if(values.begin(), values.end(), [h](const Value& v) {
+        return v.handle.mapper == h.mapper && v.handle.id == h.id;
+      });
+      if (it != values.end()) values.erase(it);
+    }
+  } // ----- END: Databroker::Cache namespace
+
+
+  namespace Changes {
+    constexpr uint8_t MaxListeners = 4;
+    uint8_t nListeners = 0;
+    std::array<ChangeListener, MaxListeners> listeners;
+    std::vector<Handle> dirty;    // Each key at most once, in the order first marked
+
+    void mark(Handle h) {
+      Cache::invalidate(h);
+      if (nListeners == 0) return;
+      for (const Handle& d : dirty) {
+        if (d.mapper == h.mapper && d.id == h.id) return;
+      }
+      dirty.push_back(h);
+    }
+  } // ----- END: Databroker::Changes namespace
+
+
   namespace System {
     constexpr char NamespacePrefix = 'S';
+    // The values are cheap to compute and the time and heap change constantly,
+    // so the namespace isn't cached
 
-    void map(const String& key, String& value) {
-      if (key.equalsIgnoreCase("time")) {
-        char buf[9];
-        time_t theTime = now();
-        sprintf(buf, "%2d|%2d|%2d", hourFormat12(theTime), minute(theTime), second(theTime));
-        value += buf;
-      }
-      else if (key.equalsIgnoreCase("author")) value += F("Joe Pasqua");
-      else if (key.equalsIgnoreCase("heap")) {
-        value += F("Heap: Free=");
-        value += GenericESP::getFreeHeap();
-        value += ", Frag=";
-        value += GenericESP::getHeapFragmentation();
-        value += '%';
+    enum Key : uint8_t {Time, Author, Heap, HeapFree, HeapFrag};
+    const char* const Keys[] = {"time", "author", "heap", "heapFree", "heapFrag"};
+
+    // Text values are formatted into buffers that outlive the call. Each key
+    // has its own, so a value remains valid until its key is mapped again.
+    void map(uint8_t id, Value& value) {
+      switch (id) {
+        case Time: {
+          static char timeBuf[12];
+          time_t theTime = now();
+          snprintf(timeBuf, sizeof(timeBuf), "%2d|%2d|%2d", hourFormat12(theTime), minute(theTime), second(theTime));
+          value.set(timeBuf);
+          break;
+        }
+        case Author: value.set("Joe Pasqua"); break;
+        case Heap: {
+          static char heapBuf[40];
+          snprintf(heapBuf, sizeof(heapBuf), "Heap: Free=%u, Frag=%u%%",
+              (unsigned)GenericESP::getFreeHeap(), (unsigned)GenericESP::getHeapFragmentation());
+          value.set(heapBuf);
+          break;
+        }
+        case HeapFree: value.set((int32_t)GenericESP::getFreeHeap()); break;
+        case HeapFrag: value.set((int32_t)GenericESP::getHeapFragmentation()); break;
       }
     }
   } // ----- END: Databroker::System namespace
 
 
+  bool Subkey::equals(const char* s) const {
+    return strncasecmp(chars, s, length) == 0 && s[length] == 0;
+  }
+
+  String Subkey::toString() const {
+    String s;
+    s.reserve(length);
+    for (uint8_t i = 0; i < length; i++) s += chars[i];
+    return s;
+  }
 
   // Upon entering this function, value is an empty String
   void map(const String& key, String& value) {
+    map(key.c_str(), key.length(), value);
+  }
+
+  void map(const char* key, size_t length, String& value) {
     // Keys are of the form: $P.subkey, where P is a prefix character indicating the namespace
-    if (key.length() < 4 || key[0] != '$' || key[2] != '.') return;
-    char prefix = key[1];
-    const String subkey(&(key.c_str()[3]));
-    Mappings::performMapping(prefix, subkey, value);
+    if (length < 4 || length > 3 + UINT8_MAX || key[0] != '$' || key[2] != '.') return;
+    Mappings::performMapping(key[1], {key + 3, (uint8_t)(length - 3)}, value);
+  }
+
+  Handle resolve(const String& key) {
+    return resolve(key.c_str(), key.length());
+  }
+
+  Handle resolve(const char* key, size_t length) {
+    if (length < 4 || length > 3 + UINT8_MAX || key[0] != '$' || key[2] != '.') return Handle();
+    return Mappings::resolve(key[1], {key + 3, (uint8_t)(length - 3)});
+  }
+
+  void map(Handle h, String& value) {
+    if (!h.valid()) return;
+    const Mappings::Entry& m = Mappings::mappers[h.mapper - 1];
+    auto compute = [&m, h](String& v) {
+      if (m.mapId) {
+        m.mapId(h.id, v);
+      } else if (m.mapTyped) {
+        Value typed;
+        m.mapTyped(h.id, typed);
+        typed.appendTo(v);
+      } else {
+        const String& subkey = m.interned[h.id];
+        m.map({subkey.c_str(), (uint8_t)subkey.length()}, v);
+      }
+    };
+
+    if (m.ttl || m.version) Cache::map(m, h, compute, value);
+    else compute(value);
+  }
+
+  void map(const Handle* handles, String* values, size_t count) {
+    for (size_t i = 0; i < count; i++) map(handles[i], values[i]);
+  }
+
+  void get(Handle h, Value& v) {
+    v.type = Value::Type::None;
+    if (!h.valid()) return;
+    const Mappings::Entry& m = Mappings::mappers[h.mapper - 1];
+    if (m.mapTyped) {
+      m.mapTyped(h.id, v);
+    } else {
+      v.storage = "";
+      map(h, v.storage);
+      v.set(v.storage.c_str(), v.storage.length());
+    }
+  }
+
+  // Text values have a length and need not be NUL terminated, so they are
+  // copied (enough of them to hold any number) before being converted
+  namespace {
+    constexpr size_t MaxNumberLength = 31;
+
+    const char* terminated(const char* text, size_t length, char (&buf)[MaxNumberLength + 1]) {
+      length = std::min(length, MaxNumberLength);
+      memcpy(buf, text, length);
+      buf[length] = '\0';
+      return buf;
+    }
+  }
+
+  int32_t Value::asInt() const {
+    char buf[MaxNumberLength + 1];
+    switch (type) {
+      case Type::Int: return i;
+      case Type::Float: return (int32_t)f;
+      case Type::Bool: return b;
+      case Type::Text: return strtol(terminated(text, length, buf), nullptr, 10);
+      default: return 0;
+    }
+  }
+
+  float Value::asFloat() const {
+    char buf[MaxNumberLength + 1];
+    switch (type) {
+      case Type::Int: return i;
+      case Type::Float: return f;
+      case Type::Bool: return b;
+      case Type::Text: return strtod(terminated(text, length, buf), nullptr);
+      default: return 0;
+    }
+  }
+
+  bool Value::asBool() const {
+    switch (type) {
+      case Type::Text:
+        if (length == 5 && strncasecmp(text, "false", 5) == 0) return false;
+        if (length == 1 && text[0] == '0') return false;
+        return length != 0;
+      default: return asInt() != 0;
+    }
+  }
+
+  void Value::appendTo(String& s) const {
+    switch (type) {
+      case Type::Int: s += i; break;
+      case Type::Float: {
+        char buf[24];
+        s += dtostrf(f, 1, decimals, buf);
+        break;
+      }
+      case Type::Bool: s += b ? F("true") : F("false"); break;
+      case Type::Text:
+        s.reserve(s.length() + length);
+        for (size_t n = 0; n < length; n++) s += text[n];
+        break;
+      default: break;
+    }
+  }
+
+  void enumerate(char prefix, KeyVisitor visit) {
+    for (uint8_t i = 0; i < Mappings::nMappers; i++) {
+      const Mappings::Entry& m = Mappings::mappers[i];
+      if (prefix && m.prefix != prefix) continue;
+      Handle h;
+      h.mapper = i + 1;
+      for (h.id = 0; h.id < m.nKeys; h.id++) visit(m.prefix, m.keys[h.id], h);
+    }
+  }
+
+  bool registerMapper(Mapper map, char prefix, KeyRecognizer recognizes) {
+    Mappings::Entry* m = Mappings::addMapper(prefix);
+    if (m == NULL) return false;
+    m->map = map;
+    m->recognizes = recognizes;
+    return true;
+  }
+
+  bool registerMapper(IdMapper map, char prefix, const char* const* keys, uint8_t nKeys) {
+    Mappings::Entry* m = Mappings::addMapper(prefix);
+    if (m == NULL) return false;
+    m->mapId = map;
+    m->keys = keys;
+    m->nKeys = nKeys;
+    return true;
+  }
+
+  bool registerMapper(TypedMapper map, char prefix, const char* const* keys, uint8_t nKeys) {
+    Mappings::Entry* m = Mappings::addMapper(prefix);
+    if (m == NULL) return false;
+    m->mapTyped = map;
+    m->keys = keys;
+    m->nKeys = nKeys;
+    return true;
+  }
+
+  bool setCachePolicy(char prefix, uint32_t ttl) {
+    Mappings::Entry* m = Mappings::findMapper(prefix);
+    if (m == NULL) return false;
+    m->ttl = ttl;
+    m->version = nullptr;
+    return true;
+  }
+
+  bool setCachePolicy(char prefix, VersionSource version) {
+    Mappings::Entry* m = Mappings::findMapper(prefix);
+    if (m == NULL) return false;
+    m->ttl = 0;
+    m->version = version;
+    return true;
+  }
+
+  void markDirty(Handle h) {
+    if (h.valid()) Changes::mark(h);
+  }
+
+  void markDirty(const String& key) {
+    markDirty(resolve(key));
+  }
+
+  void markDirty(char prefix) {
+    Mappings::Entry* m = Mappings::findMapper(prefix);
+    if (m == NULL) return;
+    size_t nKnown = m->keys ? m->nKeys : m->interned.size();
+    Handle h;
+    h.mapper = Mappings::byPrefix[(uint8_t)prefix];
+    for (size_t id = 0; id < nKnown; id++) {
+      h.id = id;
+      Changes::mark(h);
+    }
+  }
+
+  bool subscribe(ChangeListener listener) {
+    if (Changes::nListeners == Changes::MaxListeners) {
+      Log.warning("DataBroker::subscribe: No space remains for more listeners");
+      return false;
+    }
+    Changes::listeners[Changes::nListeners++] = listener;
+    return true;
+  }
+
+  void loop() {
+    if (Changes::dirty.empty()) return;
+    // Listeners may mark more changes; those are delivered next time
+    std::vector<Handle> changed;
+    changed.swap(Changes::dirty);
+    for (uint8_t i = 0; i < Changes::nListeners; i++) {
+      Changes::listeners[i](changed.data(), changed.size());
+    }
+    // Reuse the buffer rather than reallocating it for the next burst
+    if (Changes::dirty.empty()) {
+      changed.clear();
+      changed.swap(Changes::dirty);
+    }
   }
 
   bool registerMapper(Basics::ReferenceMapper map, char prefix) {
-    return Mappings::addMapper(map, prefix);
+    auto adapter = [map](const Subkey& subkey, String& value) { map(subkey.toString(), value); };
+    return registerMapper(adapter, prefix);
   }
 
   void begin() {
-    registerMapper(System::map, System::NamespacePrefix);
+    registerMapper(System::map, System::NamespacePrefix, System::Keys, countof(System::Keys));
   }
 
 };
\ No newline at end of file
@@ -10,6 +10,9 @@
 
 //--------------- Begin:  Includes ---------------------------------------------
 //                                  Core Libraries
+#include <functional>
+#include <string.h>
+#include <type_traits>
 #include <Arduino.h>
 //                                  Third Party Libraries
 #include <BPABasics.h>
@@ -17,8 +20,160 @@
 //--------------- End:    Includes ---------------------------------------------
 
 namespace DataBroker {
+  // A part of a key, e.g. the "heap" in "$S.heap". It refers to the characters
+  // of the caller's key rather than holding a copy, so it is only valid for the
+  // duration of the call it is passed to.
+  struct Subkey {
+    const char* chars;
+    uint8_t length;
+
+    // Case-insensitive comparison, like String::equalsIgnoreCase()
+    bool equals(const char* s) const;
+    String toString() const;
+  };
+
+  // Mappers are given the subkey of a key in their namespace and append its
+  // value to value.
+  using Mapper = std::function<void(const Subkey& subkey, String& value)>;
+
+  // Tells whether a mapper registered without a key table handles a subkey,
+  // whether or not it currently has a value for it
+  using KeyRecognizer = std::function<bool(const Subkey& subkey)>;
+
+  // Mappers whose keys are known in advance are given the id of a key
+  // (its index in the key table they registered) rather than its name
+  using IdMapper = std::function<void(uint8_t id, String& value)>;
+
+  // A value that keeps its type. Numbers are only formatted if text is
+  // actually needed (see appendTo()), so consumers that want a number get
+  // one without a format/parse round trip.
+  struct Value {
+    enum class Type : uint8_t {None, Int, Float, Bool, Text};
+
+    // Integers of any size are held as an int32_t and floating point values
+    // as a float, so that e.g. set(someDouble) or set(someInt) is never ambiguous
+    template<typename T>
+    typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type
+    set(T v) { type = Type::Int; i = (int32_t)v; }
+    template<typename T>
+    typename std::enable_if<std::is_floating_point<T>::value>::type
+    set(T v, uint8_t decimals = 2) { type = Type::Float; f = (float)v; this->decimals = decimals; }
+    void set(bool v) { type = Type::Bool; b = v; }
+    // The text is referenced, not copied. It must remain valid until the
+    // value has been used, e.g. a literal or a buffer owned by the mapper.
+    void set(const char* chars, size_t length) { type = Type::Text; text = chars; this->length = length; }
+    void set(const char* chars) { set(chars, strlen(chars)); }
+
+    int32_t asInt() const;
+    float asFloat() const;
+    bool asBool() const;
+
+    // Append the value, formatted as text, to s
+    void appendTo(String& s) const;
+
+    Type type = Type::None;
+    union {
+      int32_t i;
+      float f;
+      bool b;
+      const char* text;
+    };
+    size_t length = 0;      // Of text
+    uint8_t decimals = 2;   // Used when formatting f
+    String storage;         // Holds text for mappers that only produce Strings
+  };
+
+  // Mappers whose keys are known in advance may produce typed values
+  using TypedMapper = std::function<void(uint8_t id, Value& value)>;
+
+  // A key that has been resolved once so that it can be mapped any number of
+  // times without parsing it or comparing it against names. See resolve().
+  struct Handle {
+    uint8_t mapper = 0;   // 1 + the index of the mapper, 0 if invalid
+    uint8_t id = 0;       // Identifies the key within the mapper's namespace
+
+    bool valid() const { return mapper != 0; }
+  };
+
+  // Supplies the version of the data behind a namespace, e.g. the timestamp of
+  // the latest reading. Cached values are reused until the version changes.
+  using VersionSource = std::function<uint32_t()>;
+
+  // Given each key found by enumerate(): the namespace prefix, the subkey, and
+  // a handle for the key
+  using KeyVisitor = std::function<void(char prefix, const char* subkey, Handle h)>;
+
+  // Given the keys that changed since the previous notification, each once
+  using ChangeListener = std::function<void(const Handle* changed, size_t count)>;
+
   void begin();
+
+  // Deliver the changes marked since the last call to every listener. Called
+  // once per pass through WebThing::loop().
+  void loop();
+
+  // Keys are of the form $P.subkey, where P is the prefix character of the
+  // namespace, e.g. $S.heap. The value is appended to value.
   void map(const String& key, String& value);
+  void map(const char* key, size_t length, String& value);
+
+  // Resolve a key to a handle. The handle is invalid if the key is malformed,
+  // has no mapper, or isn't one of the keys registered by its mapper. For
+  // mappers registered without a key table, a key only resolves if the
+  // mapper's KeyRecognizer (if it has one) recognizes it, and at most
+  // MaxInternedKeys distinct keys are remembered per namespace.
+  constexpr uint8_t MaxInternedKeys = 32;
+  Handle resolve(const String& key);
+  Handle resolve(const char* key, size_t length);
+
+  // Append the value of a resolved key to value
+  void map(Handle h, String& value);
+
+  // Append the value of each of count handles to the corresponding element of values
+  void map(const Handle* handles, String* values, size_t count);
+
+  // Get the typed value of a resolved key. Keys whose mappers only produce
+  // text are returned as Text.
+  void get(Handle h, Value& v);
+
+  // Call visit for each key in the namespace with the given prefix, or in
+  // every namespace if prefix is 0. Only the keys of mappers registered with
+  // a key table are known to the broker, so only they are enumerated.
+  void enumerate(char prefix, KeyVisitor visit);
+
+  // Register a mapper whose keys aren't known in advance. If recognizes is
+  // given, only the keys it accepts can be resolved (see resolve()).
+  bool registerMapper(Mapper map, char prefix, KeyRecognizer recognizes = nullptr);
+
+  // Register a mapper for a fixed set of keys. The id of a key is its index in
+  // keys. The table is referenced rather than copied, so it must remain valid
+  // (e.g. a static array of string literals).
+  bool registerMapper(IdMapper map, char prefix, const char* const* keys, uint8_t nKeys);
+  bool registerMapper(TypedMapper map, char prefix, const char* const* keys, uint8_t nKeys);
+
+  // Let the broker keep the values of a namespace rather than asking its
+  // mapper each time. A value is reused until it is ttl ms old, or until
+  // version() changes, depending upon which policy is given.
+  // Only the MaxCachedValues most recently used values are kept. The cache
+  // holds text, so get() asks typed mappers directly.
+  constexpr uint8_t MaxCachedValues = 16;
+  bool setCachePolicy(char prefix, uint32_t ttl);
+  bool setCachePolicy(char prefix, VersionSource version);
+
+  // Producers mark keys whose values have changed. Any cached value of the key
+  // is discarded immediately, but listeners aren't told until the next loop(),
+  // so a burst of changes (e.g. every field of a new reading) results in a
+  // single notification that names each key once. Marking a prefix marks every
+  // key of the namespace known to the broker.
+  void markDirty(Handle h);
+  void markDirty(const String& key);
+  void markDirty(char prefix);
+
+  // Ask to be told about changed keys rather than polling for them
+  bool subscribe(ChangeListener listener);
+
+  // A ReferenceMapper is given the subkey as a String, which must be copied
+  // out of the key on each call. Prefer Mapper.
   bool registerMapper(Basics::ReferenceMapper map, char prefix);
 };
 
@@ -44,6 +44,10 @@ constexpr char magic[] = {'u', 's', 't', 'a', 'r'};
 constexpr char mode[] = {'0', '0', '0', '6', '4', '4'};
 
 class TarWriter {
+public:
+  // ----- Constants
+  static constexpr size_t BlockSize = sizeof(TarHeader);
+
 private:
   void fillHeader(TarHeader& header, String& name, size_t size) {
     memset(&header, 0, sizeof(header));
@@ -69,16 +73,44 @@ private:
     header.checksum[sizeof(header.checksum)-1] = ' ';
   }
 
-  void addFile(String& filename, std::function< void(void) > const& writeFileContent, size_t size) {
-    TarHeader header;
-    fillHeader(header, filename, size);
+  // Start the next file. Returns the number of bytes written, or 0 if
+  // there are no more files.
+  size_t beginNextFile() {
+    String filePath;
+    while (_de->next(filePath)) {
+      Log.verbose("Processing %s", filePath.c_str());
+      _file = ESP_FS::open(filePath, "r");
+      if (!_file) {
+        Log.warning("Unable to open: %s, ignoring it", filePath.c_str());
+        continue;
+      }
 
-    _out.write(&header.name[0], sizeof(header));
+      size_t size = _file.size();
+      Log.trace("streamTarFile: Adding %s", filePath.c_str());
+      TarHeader header;
+      fillHeader(header, filePath, size);
+      _out.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+      _padding = (BlockSize - (size % BlockSize)) % BlockSize;
+      return sizeof(header);
+    }
+    return 0;
+  }
 
-    writeFileContent();
+  // Finish the current file, padding it to a block boundary in a single
+  // write. Returns the number of bytes written.
+  size_t endFile() {
+    _file.close();
+    if (_padding == 0) return 0;
+    TarHeader zeros;
+    memset(&zeros, 0, sizeof(zeros));
+    _out.write(reinterpret_cast<const uint8_t*>(&zeros), _padding);
+    return _padding;
+  }
 
-    uint16_t padding = (512 - (size % 512)) % 512;
-    for (uint16_t i = 0; i < padding; i++) _out.write((uint8_t)0);
+  void writeEndOfArchive() {
+    TarHeader zeros;
+    memset(&zeros, 0, sizeof(zeros));
+    for (int i = 0; i < 2; i++) _out.write(reinterpret_cast<const uint8_t*>(&zeros), sizeof(zeros));
   }
 
   inline unsigned long computeChecksum(TarHeader& header){
@@ -99,63 +131,84 @@ private:
     }
   }
 
-  void streamFileContent(Stream& inputStream) {
-    const size_t bufferSize = 512; // Adjust the buffer size as needed
-    char buffer[bufferSize];
-
-    size_t bytesRead;
-    while ((bytesRead = inputStream.readBytes(buffer, bufferSize))) {
-      size_t bytesWritten = _out.write(buffer, bytesRead);
-      if (bytesRead != bytesWritten) {
-        Log.warning("streamFileContent: not all bytes of file were written");
-      }
-    }
-  }
-
   Print& _out;
+  ESP_FS::DirEnumerator* _de = nullptr;
+  File _file;
+  uint16_t _padding = 0;
 
 public:
+  // The output is written a block (or less) at a time and always totals
+  // a multiple of BlockSize bytes. outputStream should buffer its output.
   TarWriter(Print& outputStream): _out(outputStream) {}
 
   ~TarWriter() {
+    delete _de;
   #if !defined(ESP32)
     _out.flush(); // TO DO: Check if newer versions added flush for backwards compatibility
   #endif
   }
 
+  // Write a complete tar file of the given directory
   void streamTarFile(const String& directoryPath) {
-    Log.verbose("streamTarFile: Creating tar stream of %s", directoryPath.c_str());
+    if (!begin(directoryPath)) return;
+    while (writeSome(SIZE_MAX)) { yield(); }
+    #if !defined(ESP32)
+      _out.flush(); // TO DO: Check if newer versions added flush for backwards compatibility
+    #endif
+  }
 
-    ESP_FS::DirEnumerator* de = ESP_FS::newEnumerator();
-    if (!de->begin("/")) {
-      Log.warning("streamTarFile: Unable to enumerate /");
-      delete de;
-      return;
+  // ----- Incremental interface
+  // Rather than writing the whole tar file at once using streamTarFile(),
+  // call begin() and then call writeSome() until it returns false.
+
+  bool begin(const String& directoryPath) {
+    Log.verbose("streamTarFile: Creating tar stream of %s", directoryPath.c_str());
+    delete _de;
+    _de = ESP_FS::newEnumerator();
+    if (!_de->begin(directoryPath)) {
+      Log.warning("streamTarFile: Unable to enumerate %s", directoryPath.c_str());
+      delete _de;
+      _de = nullptr;
+      return false;
     }
+    return true;
+  }
 
-    String filePath;
-    Log.verbose("About to begin enumeration");
-    while (de->next(filePath)) {
-      Log.verbose("Processing %s", filePath.c_str());
-      File inputFile = ESP_FS::open(filePath, "r");
-      if (!inputFile) {
-        Log.warning("Unable to open: %s, ignoring it", filePath.c_str());
+  // Write roughly maxBytes of the tar file (possibly up to a few blocks more)
+  // @return true if there is more to write
+  bool writeSome(size_t maxBytes) {
+    if (!_de) return false;
+
+    // A local copy, since std::min would otherwise odr-use BlockSize
+    const size_t blockSize = BlockSize;
+    uint8_t buffer[BlockSize];
+    size_t written = 0;
+    while (written < maxBytes) {
+      if (_file) {
+        size_t bytesRead = _file.read(buffer, std::min(blockSize, maxBytes - written));
+        if (bytesRead) {
+          if (_out.write(buffer, bytesRead) != bytesRead) {
+            Log.warning("streamFileContent: not all bytes of file were written");
+          }
+          written += bytesRead;
+        } else {
+          written += endFile();
+        }
         continue;
       }
 
-      size_t size = inputFile.size();
-      Log.trace("streamTarFile: Adding %s", filePath.c_str());
-      auto writeFileContent = [this, &inputFile](void) { streamFileContent(inputFile); };
-      addFile(filePath, writeFileContent, size);
-      inputFile.close();
+      size_t headerSize = beginNextFile();
+      if (headerSize == 0) {
+        delete _de;
+        _de = nullptr;
+        writeEndOfArchive();
+        return false;
+      }
+      written += headerSize;
     }
-    delete de;
-    #if !defined(ESP32)
-      _out.flush(); // TO DO: Check if newer versions added flush for backwards compatibility
-    #endif
+    return true;
   }
 
-
 };
 
 
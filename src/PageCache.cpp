@@ -0,0 +1,151 @@
+/*
+ * PageCache:
+ *    Holds fully rendered pages so that pages whose content only changes
+ *    when the settings change can be sent with a single copy.
+ *
+ */
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <algorithm>
+//                                  Third Party Libraries
+#include <ArduinoLog.h>
+//                                  Local Includes
+#include "PageCache.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+namespace {
+  // Captures the output of a render until the page would take more than limit
+  // bytes (its text plus overhead). At that point spill() is called, once, and
+  // the rest of the output goes to the Print it returns rather than being kept.
+  class Recorder : public Print {
+  public:
+    using Spill = std::function<Print*()>;
+
+    Recorder(std::vector<char>& theText, size_t theOverhead, size_t theLimit, Spill theSpill) :
+        text(theText), overhead(theOverhead), limit(theLimit), spill(theSpill) { }
+
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t* data, size_t size) override {
+      if (!passThrough) {
+        size_t length = text.size() + size;
+        // Offsets into the text are 16 bits
+        if (length > UINT16_MAX || length + overhead > limit) passThrough = spill();
+      }
+      if (passThrough) return passThrough->write(data, size);
+      text.insert(text.end(), data, data + size);
+      return size;
+    }
+
+    bool recording() const { return passThrough == nullptr; }
+
+    std::vector<char>& text;
+    size_t overhead;        // Bytes the page uses besides its text
+  private:
+    size_t limit;
+    Spill spill;
+    Print* passThrough = nullptr;
+  };
+}
+
+void PageCache::send(
+    const String& route, uint32_t generation, WTKeyHash::Mapper mapper,
+    LiveKeys liveKeys, Renderer render, Print& out)
+{
+  Page* p = find(route);
+  if (p && p->generation == generation) {
+    write(p, mapper, out);
+    return;
+  }
+  if (p) invalidateAll(); // The settings have changed, so every page is stale
+
+  std::unique_ptr<Page> page(new Page);
+  page->route = route;
+  page->generation = generation;
+  Page* recording = page.get();
+
+  // Once the page is too big to cache, send what has been recorded so far
+  // and let the rest of the render go straight out
+  auto spill = [this, recording, &mapper, &out, &route]() -> Print* {
+    Log.verbose(F("PageCache: %s is too large to cache"), route.c_str());
+    write(recording, mapper, out);
+    std::vector<char>().swap(recording->text);
+    recording->holes.clear();
+    return &out;
+  };
+  Recorder recorder(page->text, sizeof(Page), _budget, spill);
+
+  // Record where the live keys belong rather than mapping them now
+  WTKeyHash::Mapper recordingMapper =
+    [recording, &recorder, &liveKeys, &mapper](WTKeyHash::Hash h, const String& key, String& val) {
+      if (recorder.recording() &&
+          std::find(liveKeys.begin(), liveKeys.end(), h) != liveKeys.end()) {
+        recording->holes.push_back({(uint16_t)recording->text.size(), h, key});
+        recorder.overhead += sizeof(Hole) + key.length();
+      } else {
+        mapper(h, key, val);
+      }
+    };
+  render(recorder, recordingMapper);
+  if (!recorder.recording()) return;
+
+  page->text.shrink_to_fit();
+  page->footprint = recorder.overhead + page->text.size();
+
+  write(page.get(), mapper, out);
+  if (page->footprint > _budget) return;
+
+  evict(page->footprint);
+  _bytesUsed += page->footprint;
+  _pages.insert(_pages.begin(), std::move(page));
+  Log.verbose(
+      F("PageCache: Cached %s (%d bytes, %d in use)"),
+      route.c_str(), _pages.front()->footprint, _bytesUsed);
+}
+
+void PageCache::invalidateAll() {
+  _pages.clear();
+  _bytesUsed = 0;
+}
+
+void PageCache::setBudget(size_t budget) {
+  _budget = budget;
+  evict(0);
+}
+
+
+//
+// ----- Private Member Functions
+//
+
+PageCache::Page* PageCache::find(const String& route) {
+  for (auto it = _pages.begin(); it != _pages.end(); ++it) {
+    if ((*it)->route == route) {
+      std::rotate(_pages.begin(), it, it+1);
+      return _pages.front().get();
+    }
+  }
+  return nullptr;
+}
+
+void PageCache::write(const Page* p, WTKeyHash::Mapper& mapper, Print& out) {
+  const char* text = p->text.data();
+  uint16_t written = 0;
+  for (const Hole& h : p->holes) {
+    out.write(text + written, h.offset - written);
+    written = h.offset;
+    String val;
+    mapper(h.hash, h.key, val);
+    if (val.length()) out.print(val);
+  }
+  out.write(text + written, p->text.size() - written);
+}
+
+void PageCache::evict(size_t needed) {
+  while (!_pages.empty() && _bytesUsed + needed > _budget) {
+    Log.verbose(F("PageCache: Evicting %s"), _pages.back()->route.c_str());
+    _bytesUsed -= _pages.back()->footprint;
+    _pages.pop_back();
+  }
+}
@@ -0,0 +1,94 @@
+/*
+ * PageCache:
+ *    Holds fully rendered pages so that pages whose content only changes
+ *    when the settings change can be sent with a single copy rather than
+ *    being rebuilt from their templates on each request.
+ *
+ * NOTES:
+ * o Each page is stored with the settings generation it was rendered from
+ *   (see BaseSettings::generation()). A page from an older generation is
+ *   never sent; it is rendered again.
+ * o Some placeholders must always be current (e.g. free heap). Those are
+ *   named as "live" keys when the page is sent. Their position in the
+ *   rendered page is recorded and the mapper is asked for their value each
+ *   time the page is sent.
+ * o The cache is disabled until it is given a budget using setBudget().
+ *   A page that turns out to be larger than the budget stops being recorded
+ *   as soon as it is, and the rest of it is sent as it is rendered.
+ *
+ */
+
+#ifndef PageCache_h
+#define PageCache_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <functional>
+#include <initializer_list>
+#include <memory>
+#include <vector>
+#include <Arduino.h>
+//                                  Third Party Libraries
+//                                  Local Includes
+#include "WTKeyHash.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+class PageCache {
+public:
+  // ----- Types
+  using LiveKeys = std::initializer_list<WTKeyHash::Hash>;
+  // Renders the page to out, using mapper for the placeholders of the page body
+  using Renderer = std::function<void(Print& out, WTKeyHash::Mapper& mapper)>;
+
+  // ----- Member Functions
+
+  // Send a page, rendering it only if there is no current copy in the cache
+  // @param route       Identifies the page
+  // @param generation  The generation of the settings the page depends on
+  // @param mapper      Provides values for the body of the page, including live keys
+  // @param liveKeys    Keys whose values are mapped each time the page is sent
+  // @param render      Renders the page if it isn't in the cache
+  // @param out         Where the page is sent
+  void send(
+      const String& route, uint32_t generation, WTKeyHash::Mapper mapper,
+      LiveKeys liveKeys, Renderer render, Print& out);
+
+  // Discard all cached pages
+  void invalidateAll();
+
+  // Change the number of bytes that may be used to hold rendered pages.
+  // 0 disables the cache.
+  void setBudget(size_t budget);
+
+  bool enabled() const { return _budget != 0; }
+  size_t bytesUsed() const { return _bytesUsed; }
+
+private:
+  // ----- Types
+  struct Hole {
+    uint16_t offset;      // Where in the text the value belongs
+    WTKeyHash::Hash hash;
+    String key;
+  };
+
+  struct Page {
+    String route;
+    uint32_t generation;
+    std::vector<char> text;
+    std::vector<Hole> holes;
+    size_t footprint;
+  };
+
+  // ----- Member Functions
+  Page* find(const String& route);
+  void write(const Page* p, WTKeyHash::Mapper& mapper, Print& out);
+  void evict(size_t needed);
+
+  // ----- Data Members
+  size_t _budget = 0;
+  size_t _bytesUsed = 0;
+  std::vector<std::unique_ptr<Page>> _pages;  // Most recently used first
+};
+
+#endif  // PageCache_h
@@ -0,0 +1,209 @@
+/*
+ * TemplateCache:
+ *    Parses HTML templates once into a list of literal segments and
+ *    placeholders, then renders them from that representation on subsequent
+ *    requests.
+ *
+ * NOTES:
+ * o Literal text for a template is stored contiguously in a single buffer.
+ *   Segments refer to runs of that buffer, or to one of the template's keys.
+ *
+ */
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <algorithm>
+//                                  Third Party Libraries
+#include <ArduinoLog.h>
+#include <ESP_FS.h>
+//                                  Local Includes
+#include "TemplateCache.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+bool TemplateCache::send(const String& path, Mapper mapper, Print& out) {
+  return send(
+      path,
+      [&mapper](WTKeyHash::Hash, const String& key, String& val) { mapper(key, val); },
+      out);
+}
+
+bool TemplateCache::send(const String& path, HashedMapper mapper, Print& out) {
+  Template* t = find(path);
+  if (t) {
+    render(t, mapper, out);
+    return true;
+  }
+
+  File f = ESP_FS::open(path, "r");
+  if (!f) {
+    Log.warning(F("TemplateCache: Unable to open %s"), path.c_str());
+    return false;
+  }
+
+  size_t size = f.size();
+  if (size > _budget || size > UINT16_MAX) {
+    bool result = stream(f, path, mapper, out);
+    f.close();
+    return result;
+  }
+
+  t = load(f, path);
+  f.close();
+  if (!t) return false;
+  render(t, mapper, out);
+  return true;
+}
+
+void TemplateCache::invalidate(const String& path) {
+  for (auto it = _templates.begin(); it != _templates.end(); ++it) {
+    if ((*it)->path == path) {
+      Log.verbose(F("TemplateCache: Invalidating %s"), path.c_str());
+      _bytesUsed -= (*it)->footprint;
+      _templates.erase(it);
+      return;
+    }
+  }
+}
+
+void TemplateCache::invalidateAll() {
+  _templates.clear();
+  _bytesUsed = 0;
+}
+
+void TemplateCache::setBudget(size_t budget) {
+  _budget = budget;
+  evict(0);
+}
+
+
+//
+// ----- Private Member Functions
+//
+
+template<typename LiteralFn, typename KeyFn>
+bool TemplateCache::parse(File& f, LiteralFn onLiteral, KeyFn onKey) {
+  uint8_t buffer[128];
+  String key;
+  bool inKey = false;
+  bool escaped = false;
+
+  size_t bytesRead;
+  while ((bytesRead = f.read(buffer, sizeof(buffer))) > 0) {
+    for (size_t i = 0; i < bytesRead; i++) {
+      char c = buffer[i];
+      if (inKey) {
+        if (c == Marker) { onKey(key); key.clear(); inKey = false; }
+        else key.concat(c);
+      } else if (escaped) {
+        if (c != Marker) onLiteral(Escape);
+        onLiteral(c);
+        escaped = false;
+      } else if (c == Escape) {
+        escaped = true;
+      } else if (c == Marker) {
+        inKey = true;
+      } else {
+        onLiteral(c);
+      }
+    }
+  }
+  if (escaped) onLiteral(Escape);
+
+  return !inKey;
+}
+
+TemplateCache::Template* TemplateCache::find(const String& path) {
+  for (auto it = _templates.begin(); it != _templates.end(); ++it) {
+    if ((*it)->path == path) {
+      // Move to the front so the least recently used template is last
+      std::rotate(_templates.begin(), it, it+1);
+      return _templates.front().get();
+    }
+  }
+  return nullptr;
+}
+
+TemplateCache::Template* TemplateCache::load(File& f, const String& path) {
+  size_t size = f.size();
+  std::unique_ptr<Template> t(new Template);
+  t->path = path;
+  t->text.reset(new char[size ? size : 1]);
+
+  uint16_t textLength = 0;
+  auto onLiteral = [&t, &textLength](char c) {
+    if (t->segments.empty() || t->segments.back().key != Literal) {
+      t->segments.push_back({textLength, 0, Literal});
+    }
+    t->text[textLength++] = c;
+    t->segments.back().length++;
+  };
+  auto onKey = [&t](const String& key) {
+    t->keys.push_back(key);
+    t->hashes.push_back(WTKeyHash::of(key));
+    t->segments.push_back({0, 0, (int16_t)(t->keys.size()-1)});
+  };
+
+  if (!parse(f, onLiteral, onKey)) {
+    Log.warning(F("TemplateCache: Cannot process template: %s"), path.c_str());
+    return nullptr;
+  }
+  t->segments.shrink_to_fit();
+  t->keys.shrink_to_fit();
+  t->hashes.shrink_to_fit();
+
+  t->footprint = sizeof(Template) + size + t->segments.size() * sizeof(Segment);
+  for (const String& key : t->keys) {
+    t->footprint += sizeof(String) + key.length() + sizeof(WTKeyHash::Hash);
+  }
+
+  evict(t->footprint);
+  _bytesUsed += t->footprint;
+  _templates.insert(_templates.begin(), std::move(t));
+  Log.verbose(
+      F("TemplateCache: Cached %s (%d bytes, %d in use)"),
+      path.c_str(), _templates.front()->footprint, _bytesUsed);
+  return _templates.front().get();
+}
+
+void TemplateCache::render(const Template* t, HashedMapper& mapper, Print& out) {
+  for (const Segment& s : t->segments) {
+    if (s.key == Literal) {
+      out.write(&(t->text[s.start]), s.length);
+    } else {
+      String val;
+      mapper(t->hashes[s.key], t->keys[s.key], val);
+      if (val.length()) out.print(val);
+    }
+  }
+}
+
+bool TemplateCache::stream(File& f, const String& path, HashedMapper& mapper, Print& out) {
+  char buffer[128];
+  size_t length = 0;
+  auto flush = [&]() { if (length) { out.write(buffer, length); length = 0; } };
+
+  auto onLiteral = [&](char c) {
+    buffer[length++] = c;
+    if (length == sizeof(buffer)) flush();
+  };
+  auto onKey = [&](const String& key) {
+    flush();
+    String val;
+    mapper(WTKeyHash::of(key), key, val);
+    if (val.length()) out.print(val);
+  };
+
+  bool result = parse(f, onLiteral, onKey);
+  flush();
+  if (!result) Log.warning(F("TemplateCache: Cannot process template: %s"), path.c_str());
+  return result;
+}
+
+void TemplateCache::evict(size_t needed) {
+  while (!_templates.empty() && _bytesUsed + needed > _budget) {
+    Log.verbose(F("TemplateCache: Evicting %s"), _templates.back()->path.c_str());
+    _bytesUsed -= _templates.back()->footprint;
+    _templates.pop_back();
+  }
+}
@@ -0,0 +1,111 @@
+/*
+ * TemplateCache:
+ *    Parses HTML templates once into a list of literal segments and
+ *    placeholders, then renders them from that representation on subsequent
+ *    requests. The template syntax is the same as ESPTemplateProcessor:
+ *    placeholders are of the form %KEY% and a literal '%' is written as \%
+ *
+ * NOTES:
+ * o The cache holds at most 'budget' bytes. Least recently used templates
+ *   are evicted to make room. Templates that are larger than the budget are
+ *   never cached; they are parsed as they are streamed from the file system.
+ * o Any time a template file changes, invalidate() must be called for it.
+ *
+ */
+
+#ifndef TemplateCache_h
+#define TemplateCache_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <memory>
+#include <vector>
+#include <Arduino.h>
+#include <FS.h>
+//                                  Third Party Libraries
+#include <ESPTemplateProcessor.h>
+//                                  Local Includes
+#include "WTKeyHash.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+class TemplateCache {
+public:
+  // ----- Types
+  using Mapper = ESPTemplateProcessor::Mapper;
+  using HashedMapper = WTKeyHash::Mapper;
+
+  // ----- Constants
+  static constexpr char Marker = '%';
+  static constexpr char Escape = '\\';
+#if defined(ESP32)
+  static constexpr size_t DefaultBudget = 16*1024;
+#else
+  static constexpr size_t DefaultBudget = 4*1024;
+#endif
+
+  // ----- Constructors
+  TemplateCache(size_t budget = DefaultBudget) : _budget(budget) { }
+
+  // ----- Member Functions
+
+  // Render a template to the given output, substituting values supplied
+  // by the mapper for each placeholder.
+  // @param path    The path of the template in the file system
+  // @param mapper  Provides the value for each placeholder
+  // @param out     Where the rendered output is written
+  // @return false if the template could not be read or parsed
+  bool send(const String& path, Mapper mapper, Print& out);
+
+  // As above, but the mapper is also given a hash of each key so that it can
+  // dispatch using a switch statement. See WTKeyHash. The hashes of the keys
+  // in a cached template are computed when it is loaded.
+  bool send(const String& path, HashedMapper mapper, Print& out);
+
+  // Discard any cached representation of the template at the given path
+  void invalidate(const String& path);
+
+  // Discard all cached templates
+  void invalidateAll();
+
+  // Change the number of bytes that may be used to cache templates
+  void setBudget(size_t budget);
+
+  size_t bytesUsed() const { return _bytesUsed; }
+
+private:
+  // ----- Types
+  static constexpr int16_t Literal = -1;
+
+  struct Segment {
+    uint16_t start;   // Offset into text (literals only)
+    uint16_t length;  // Length in text (literals only)
+    int16_t  key;     // Index into keys, or Literal
+  };
+
+  struct Template {
+    String path;
+    std::unique_ptr<char[]> text;
+    std::vector<Segment> segments;
+    std::vector<String> keys;
+    std::vector<WTKeyHash::Hash> hashes;  // One for each key
+    size_t footprint;
+  };
+
+  // ----- Member Functions
+  Template* find(const String& path);
+  Template* load(File& f, const String& path);
+  void render(const Template* t, HashedMapper& mapper, Print& out);
+  bool stream(File& f, const String& path, HashedMapper& mapper, Print& out);
+  void evict(size_t needed);
+
+  template<typename LiteralFn, typename KeyFn>
+  static bool parse(File& f, LiteralFn onLiteral, KeyFn onKey);
+
+  // ----- Data Members
+  size_t _budget;
+  size_t _bytesUsed = 0;
+  std::vector<std::unique_ptr<Template>> _templates;  // Most recently used first
+};
+
+#endif  // TemplateCache_h
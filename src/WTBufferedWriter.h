@@ -0,0 +1,98 @@
+/*
+ * WTBufferedWriter:
+ *    A Print implementation that coalesces many small writes into a fixed
+ *    size buffer and only hands data to the underlying sink when the buffer
+ *    is full or when flush() is called. Subclasses supply the sink by
+ *    implementing emit().
+ *
+ * NOTES:
+ * o The buffer is part of the object, so writing never allocates.
+ * o Writes that are at least as large as the buffer, and which arrive when
+ *   the buffer is empty, are emitted directly without being copied.
+ *
+ */
+
+#ifndef WTBufferedWriter_h
+#define WTBufferedWriter_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <Arduino.h>
+//                                  Third Party Libraries
+//                                  Local Includes
+//--------------- End:    Includes ---------------------------------------------
+
+
+template<size_t Capacity>
+class WTBufferedWriter : public Print {
+public:
+  // ----- Member Functions
+  size_t write(uint8_t data) override {
+    _buffer[_length++] = data;
+    if (_length == Capacity) flush();
+    return 1;
+  }
+
+  size_t write(const uint8_t* data, size_t size) override {
+    size_t remaining = size;
+    while (remaining) {
+      if (_length == 0 && remaining >= Capacity) {
+        emitAndCount(data, Capacity);
+        data += Capacity; remaining -= Capacity;
+        continue;
+      }
+      size_t n = std::min(remaining, Capacity - _length);
+      memcpy(&_buffer[_length], data, n);
+      _length += n; data += n; remaining -= n;
+      if (_length == Capacity) flush();
+    }
+    return size;
+  }
+
+  // Hand any buffered data to the sink
+  void flush() {
+    if (_length == 0) return;
+    emitAndCount(_buffer, _length);
+    _length = 0;
+  }
+
+  // Discard any buffered data without emitting it
+  void reset() { _length = 0; }
+
+  // The number of bytes waiting in the buffer
+  size_t pending() const { return _length; }
+
+  // The total number of bytes handed to the sink so far
+  size_t bytesEmitted() const { return _bytesEmitted; }
+
+protected:
+  // ----- Member Functions
+  // Called with a full buffer (or less when flushing). Never called with 0 bytes
+  virtual void emit(const uint8_t* data, size_t length) = 0;
+
+private:
+  void emitAndCount(const uint8_t* data, size_t length) {
+    emit(data, length);
+    _bytesEmitted += length;
+  }
+
+  // ----- Data Members
+  uint8_t _buffer[Capacity];
+  size_t  _length = 0;
+  size_t  _bytesEmitted = 0;
+};
+
+// Buffers writes to any other Print, e.g. a WiFiClient
+template<size_t Capacity>
+class WTPrintWriter : public WTBufferedWriter<Capacity> {
+public:
+  WTPrintWriter(Print& out) : _out(out) { }
+
+protected:
+  void emit(const uint8_t* data, size_t length) override { _out.write(data, length); }
+
+private:
+  Print& _out;
+};
+
+#endif  // WTBufferedWriter_h
@@ -0,0 +1,48 @@
+/*
+ * WTCrc32:
+ *    A small, table-light implementation of the standard (IEEE 802.3 / zlib)
+ *    CRC-32. Results match those of common host tools such as crc32 or
+ *    Python's zlib.crc32(), so values computed on the device can be
+ *    compared with values computed elsewhere.
+ *
+ */
+
+#ifndef WTCrc32_h
+#define WTCrc32_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <stddef.h>
+#include <stdint.h>
+//                                  Third Party Libraries
+//                                  Local Includes
+//--------------- End:    Includes ---------------------------------------------
+
+
+namespace WTCrc32 {
+  // Compute the CRC of a block of data. To compute a CRC incrementally, pass
+  // the result of the previous call as the crc for the next. Start with 0.
+  // @param crc     The CRC of the data seen so far (0 if none)
+  // @param data    The next block of data
+  // @param length  The number of bytes in data
+  // @return The CRC of all data seen so far
+  inline uint32_t update(uint32_t crc, const uint8_t* data, size_t length) {
+    // Uses a 16 entry (nibble) table to trade a little speed for a lot of space
+    static const uint32_t Table[16] = {
+      0x00000000, 0x1DB71064, 0x3B6E20C8, 0x26D930AC,
+      0x76DC4190, 0x6B6B51F4, 0x4DB26158, 0x5005713C,
+      0xEDB88320, 0xF00F9344, 0xD6D6A3E8, 0xCB61B38C,
+      0x9B64C2B0, 0x86D3D2D4, 0xA00AE278, 0xBDBDF21C
+    };
+
+    crc = ~crc;
+    while (length--) {
+      uint8_t b = *data++;
+      crc = (crc >> 4) ^ Table[(crc ^ b) & 0x0f];
+      crc = (crc >> 4) ^ Table[(crc ^ (b >> 4)) & 0x0f];
+    }
+    return ~crc;
+  }
+}
+
+#endif  // WTCrc32_h
@@ -0,0 +1,142 @@
+/*
+ * WTFileCache:
+ *    Keeps copies of fetched content in the file system so that repeated
+ *    requests for the same resource can be answered locally until the copy
+ *    expires.
+ *
+ * NOTES:
+ * o Files are named using a CRC of the key. The full key is kept in the
+ *   index so a collision can't return the wrong content.
+ *
+ */
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+//                                  Third Party Libraries
+#include <ArduinoLog.h>
+#include <ESP_FS.h>
+//                                  Local Includes
+#include "WTFileCache.h"
+#include "WTCrc32.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+namespace {
+  uint32_t idFor(const String& key) {
+    return WTCrc32::update(0, reinterpret_cast<const uint8_t*>(key.c_str()), key.length());
+  }
+}
+
+void WTFileCache::configure(uint32_t ttl, size_t maxBytes) {
+  _ttl = ttl;
+  _maxBytes = maxBytes;
+  _entries.clear();
+  _bytesUsed = 0;
+
+  // Remove anything left behind, including content from previous boots
+  ESP_FS::DirEnumerator* de = ESP_FS::newEnumerator();
+  if (de->begin("/")) {
+    std::vector<String> stale;
+    String path;
+    while (de->next(path)) {
+      if (path.startsWith(_prefix)) stale.push_back(path);
+    }
+    for (const String& p : stale) ESP_FS::remove(p);
+  }
+  delete de;
+}
+
+File WTFileCache::get(const String& key) {
+  if (!enabled()) return File();
+
+  for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+    if (it->key != key) continue;
+    if (expired(*it)) {
+      Log.verbose(F("WTFileCache: %s has expired"), key.c_str());
+      remove(it);
+      return File();
+    }
+    return ESP_FS::open(pathFor(it->id), "r");
+  }
+  return File();
+}
+
+WTFileCache::Store WTFileCache::beginStore(const String& key) {
+  Store s;
+  if (!enabled()) return s;
+  s.key = key;
+  s.partPath = String(_prefix) + "part" + _nextStore++;
+  s.file = ESP_FS::open(s.partPath, "w");
+  return s;
+}
+
+void WTFileCache::commit(Store& s) {
+  if (!s.file) return;
+  size_t size = s.file.size();
+  s.file.close();
+
+  uint32_t id = idFor(s.key);
+  String path = pathFor(id);
+  if (size > _maxBytes) {
+    Log.verbose(F("WTFileCache: %s is too large to cache"), s.key.c_str());
+    ESP_FS::remove(s.partPath);
+    return;
+  }
+
+  // Replace any existing entry for the same key (or with the same id)
+  for (auto it = _entries.begin(); it != _entries.end(); ++it) {
+    if (it->id == id) { remove(it); break; }
+  }
+  makeRoom(size);
+
+  if (!ESP_FS::move(s.partPath.c_str(), path.c_str())) {
+    Log.warning(F("WTFileCache: Unable to move %s to %s"), s.partPath.c_str(), path.c_str());
+    ESP_FS::remove(s.partPath);
+    return;
+  }
+
+  _entries.push_back({s.key, id, size, (uint32_t)millis()});
+  _bytesUsed += size;
+  Log.verbose(
+      F("WTFileCache: Stored %s (%d bytes, %d in use)"),
+      s.key.c_str(), size, _bytesUsed);
+}
+
+void WTFileCache::abort(Store& s) {
+  if (!s.file) return;
+  s.file.close();
+  ESP_FS::remove(s.partPath);
+}
+
+
+//
+// ----- Private Member Functions
+//
+
+String WTFileCache::pathFor(uint32_t id) const {
+  char name[9];
+  sprintf(name, "%08x", (unsigned)id);
+  return String(_prefix) + name;
+}
+
+bool WTFileCache::expired(const Entry& e) const {
+  return (millis() - e.storedAt) / 1000 >= _ttl;
+}
+
+std::vector<WTFileCache::Entry>::iterator WTFileCache::remove(std::vector<Entry>::iterator it) {
+  ESP_FS::remove(pathFor(it->id));
+  _bytesUsed -= it->size;
+  return _entries.erase(it);
+}
+
+void WTFileCache::makeRoom(size_t needed) {
+  // First discard anything that has expired, then the oldest entries
+  for (auto it = _entries.begin(); it != _entries.end(); ) {
+    if (expired(*it)) it = remove(it);
+    else ++it;
+  }
+  while (!_entries.empty() &&
+         (_entries.size() >= MaxEntries || _bytesUsed + needed > _maxBytes)) {
+    remove(_entries.begin());
+  }
+}
@@ -0,0 +1,98 @@
+/*
+ * WTFileCache:
+ *    Keeps copies of fetched content in the file system so that repeated
+ *    requests for the same resource can be answered locally until the copy
+ *    expires. Entries are identified by an arbitrary key (e.g. a URL).
+ *
+ * NOTES:
+ * o The index of entries is kept in RAM. Files left behind by a previous
+ *   boot are unknown to the index, so they are removed by configure().
+ * o Content is written to a temporary file and only becomes visible once
+ *   it has been stored completely (see beginStore() / commit()). Each store
+ *   has its own temporary file, so several may be in progress at once.
+ *
+ */
+
+#ifndef WTFileCache_h
+#define WTFileCache_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <vector>
+#include <Arduino.h>
+#include <FS.h>
+//                                  Third Party Libraries
+//                                  Local Includes
+//--------------- End:    Includes ---------------------------------------------
+
+
+class WTFileCache {
+public:
+  // ----- Constants
+  static constexpr uint8_t MaxEntries = 8;
+
+  // ----- Types
+  // Content being stored for a key. See beginStore().
+  struct Store {
+    String key;
+    String partPath;
+    File file;          // Closed if the content isn't being stored
+  };
+
+  // ----- Constructors
+  // @param prefix  The path prefix for the cache's files, e.g. "/wt/pass_"
+  WTFileCache(const char* prefix) : _prefix(prefix) { }
+
+  // ----- Member Functions
+
+  // Set the cache parameters and discard any existing content
+  // @param ttl       Seconds an entry remains valid. 0 disables the cache.
+  // @param maxBytes  The total size of all entries will not exceed this
+  void configure(uint32_t ttl, size_t maxBytes);
+
+  bool enabled() const { return _ttl != 0; }
+  uint32_t ttl() const { return _ttl; }
+  size_t maxBytes() const { return _maxBytes; }
+
+  // Open the cached copy of the content for a key
+  // @return The open file, or a closed File if there is no current copy
+  File get(const String& key);
+
+  // Begin storing the content for a key. Write the content to the store's
+  // file, then call commit() or abort() with the store.
+  // @return The store. Its file is closed if the content can't be stored.
+  Store beginStore(const String& key);
+
+  // Make the content written to a store available to get()
+  // @param s   A store returned by beginStore(). Its file will be closed.
+  void commit(Store& s);
+
+  // Discard the content written to a store
+  // @param s   A store returned by beginStore(). Its file will be closed.
+  void abort(Store& s);
+
+private:
+  // ----- Types
+  struct Entry {
+    String key;
+    uint32_t id;
+    size_t size;
+    uint32_t storedAt;    // millis()
+  };
+
+  // ----- Member Functions
+  String pathFor(uint32_t id) const;
+  bool expired(const Entry& e) const;
+  std::vector<Entry>::iterator remove(std::vector<Entry>::iterator it);
+  void makeRoom(size_t needed);
+
+  // ----- Data Members
+  const char* _prefix;
+  uint32_t _ttl = 0;
+  size_t _maxBytes = 0;
+  size_t _bytesUsed = 0;
+  std::vector<Entry> _entries;  // Oldest first
+  uint16_t _nextStore = 0;      // Distinguishes the files of stores in progress
+};
+
+#endif  // WTFileCache_h
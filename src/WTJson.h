@@ -0,0 +1,46 @@
+/*
+ * WTJson:
+ *    Helpers for writing JSON directly to a Print without building a
+ *    JsonDocument first.
+ *
+ */
+
+#ifndef WTJson_h
+#define WTJson_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <Arduino.h>
+//                                  Third Party Libraries
+//                                  Local Includes
+//--------------- End:    Includes ---------------------------------------------
+
+
+namespace WTJson {
+  // Write the first length characters of s as a quoted JSON string,
+  // escaping characters as required
+  inline void writeString(Print& out, const char* s, size_t length) {
+    out.print('"');
+    for (const char* end = s + length; s < end; s++) {
+      char c = *s;
+      switch (c) {
+        case '"':  out.print(F("\\\"")); break;
+        case '\\': out.print(F("\\\\")); break;
+        case '\n': out.print(F("\\n")); break;
+        case '\r': out.print(F("\\r")); break;
+        case '\t': out.print(F("\\t")); break;
+        default:
+          if ((uint8_t)c < 0x20) { out.printf("\\u%04x", c); }
+          else out.print(c);
+      }
+    }
+    out.print('"');
+  }
+
+  // Write s as a quoted JSON string, escaping characters as required
+  inline void writeString(Print& out, const char* s) {
+    writeString(out, s, strlen(s));
+  }
+}
+
+#endif  // WTJson_h
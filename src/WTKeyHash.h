@@ -0,0 +1,65 @@
+/*
+ * WTKeyHash:
+ *    FNV-1a hashing of template placeholder keys. Hashes of known keys are
+ *    computed at compile time so a mapper can dispatch on them with a switch
+ *    statement rather than comparing the key against each name in turn:
+ *
+ *      auto mapper = [](WTKeyHash::Hash h, const String& key, String& val) {
+ *        switch (h) {
+ *          case "TITLE"_kh:    val = title; break;
+ *          case "VERSION"_kh:  val = version; break;
+ *        }
+ *      };
+ *
+ * NOTES:
+ * o Two case labels with the same hash are a compile time error, so keys
+ *   that a mapper handles can't be confused with each other. The mapper
+ *   isn't told about other keys, though: a key it doesn't handle whose hash
+ *   happens to equal a handled key's is taken to be that key. For the keys
+ *   in a template the odds are very small (about 1 in 2^32 per pair), but a
+ *   mapper given keys it doesn't control should compare the key itself
+ *   once the hash has matched.
+ * o The key itself is still passed to the mapper for keys that are
+ *   computed at runtime (e.g. "SL" + the current selection).
+ *
+ */
+
+#ifndef WTKeyHash_h
+#define WTKeyHash_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <functional>
+#include <Arduino.h>
+//                                  Third Party Libraries
+//                                  Local Includes
+//--------------- End:    Includes ---------------------------------------------
+
+
+namespace WTKeyHash {
+  using Hash = uint32_t;
+  using Mapper = std::function<void(Hash keyHash, const String& key, String& val)>;
+
+  constexpr Hash OffsetBasis = 2166136261u;
+  constexpr Hash Prime = 16777619u;
+
+  // Compile time version. Written recursively so that it is a valid
+  // C++11 constexpr function.
+  constexpr Hash of(const char* s, size_t length, Hash h = OffsetBasis) {
+    return length == 0 ? h : of(s + 1, length - 1, (h ^ (uint8_t)*s) * Prime);
+  }
+
+  // Runtime version
+  inline Hash of(const String& key) {
+    Hash h = OffsetBasis;
+    const char* s = key.c_str();
+    for (size_t i = key.length(); i > 0; i--) h = (h ^ (uint8_t)*s++) * Prime;
+    return h;
+  }
+}
+
+constexpr WTKeyHash::Hash operator"" _kh(const char* s, size_t length) {
+  return WTKeyHash::of(s, length);
+}
+
+#endif  // WTKeyHash_h
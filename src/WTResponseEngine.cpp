@@ -0,0 +1,139 @@
+/*
+ * WTResponseEngine:
+ *    Sends large responses a slice at a time so that the rest of the
+ *    application keeps running while a transfer is in progress.
+ *
+ * NOTES:
+ * o On ESP8266 a slice is only produced when the connection can accept it
+ *   without blocking, so a slow client costs very little time per loop().
+ *   ESP32 has no equivalent of availableForWrite(), so there the writes
+ *   may block (see WTResponseEngine.h).
+ * o A response that makes no progress for StallTimeout ms is abandoned,
+ *   whether the client isn't reading or the producer has nothing to send.
+ *
+ */
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+//                                  Third Party Libraries
+#include <ArduinoLog.h>
+//                                  Local Includes
+#include "WTResponseEngine.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+void WTResponseEngine::start(
+    WiFiClient client, const String& code, const String& type, int32_t length,
+    const String& headers, WTProducer* producer, const char* label)
+{
+  bool chunked = (length < 0);
+  String head;
+  head.reserve(128 + headers.length());
+  head += "HTTP/1.1 "; head += code; head += "\r\n";
+  head += "Content-Type: "; head += type; head += "\r\n";
+  if (chunked) head += "Transfer-Encoding: chunked\r\n";
+  else { head += "Content-Length: "; head += length; head += "\r\n"; }
+  head += "Connection: close\r\n";
+  head += headers;
+  head += "\r\n";
+  client.write(head.c_str(), head.length());
+
+  std::unique_ptr<Response> r(new Response(client, chunked, producer));
+  r->label = label;
+  r->startTime = r->lastProgress = millis();
+  if (!producer || !step(*r)) { finish(*r); return; }
+
+  for (auto& slot : _responses) {
+    if (!slot) { slot = std::move(r); return; }
+  }
+
+  // No free slots, send the whole thing now. A stalled client is still
+  // abandoned after StallTimeout rather than holding up loop() indefinitely.
+  Log.verbose(F("WTResponseEngine: All slots busy, sending synchronously"));
+  while (service(*r)) { yield(); }
+}
+
+void WTResponseEngine::pump() {
+  for (auto& slot : _responses) {
+    if (slot && !service(*slot)) slot.reset();
+  }
+}
+
+uint8_t WTResponseEngine::active() const {
+  uint8_t n = 0;
+  for (const auto& slot : _responses) if (slot) n++;
+  return n;
+}
+
+
+//
+// ----- Private Member Functions
+//
+
+// Send the next slice of r if the client can take it
+// @return false once r has been finished or abandoned
+bool WTResponseEngine::service(Response& r) {
+  WiFiClient& client = r.writer.client;
+
+  if (!client.connected()) {
+    Log.warning(F("WTResponseEngine: Client disconnected during response"));
+    client.stop();
+    report(r);
+    return false;
+  }
+
+  bool canWrite = true;
+#if defined(ESP8266)
+  // Don't block waiting for the client to acknowledge earlier slices
+  canWrite = (size_t)client.availableForWrite() >= SliceSize;
+#endif
+
+  if (canWrite && !step(r)) { finish(r); return false; }
+
+  if (millis() - r.lastProgress > StallTimeout) {
+    Log.warning(F("WTResponseEngine: Response stalled, abandoning it"));
+    client.stop();
+    report(r);
+    return false;
+  }
+  return true;
+}
+
+bool WTResponseEngine::step(Response& r) {
+  size_t before = r.writer.bytesEmitted() + r.writer.pending();
+  uint32_t start = micros();
+  bool more = r.producer->produce(r.writer, SliceSize);
+  uint32_t elapsed = micros() - start;
+
+  if (r.writer.bytesEmitted() + r.writer.pending() != before) r.lastProgress = millis();
+  if (elapsed > r.longestSlice) r.longestSlice = elapsed;
+  if (elapsed > _longestSlice) _longestSlice = elapsed;
+  return more;
+}
+
+void WTResponseEngine::finish(Response& r) {
+  r.writer.flush();
+  if (r.writer.chunked) r.writer.client.write("0\r\n\r\n", 5);
+  r.writer.client.flush();
+  r.writer.client.stop();
+  Log.trace(
+      F("WTResponseEngine: Sent %d bytes in %dms, longest slice: %dus"),
+      r.writer.bytesEmitted(), millis() - r.startTime, r.longestSlice);
+  report(r);
+}
+
+void WTResponseEngine::report(const Response& r) {
+  if (_onFinish) _onFinish(r.label, millis() - r.startTime, r.writer.bytesEmitted());
+}
+
+void WTResponseEngine::ClientWriter::emit(const uint8_t* data, size_t length) {
+  if (chunked) {
+    char size[12];
+    int n = sprintf(size, "%x\r\n", (unsigned)length);
+    client.write(size, n);
+    client.write(data, length);
+    client.write("\r\n", 2);
+  } else {
+    client.write(data, length);
+  }
+}
@@ -0,0 +1,129 @@
+/*
+ * WTResponseEngine:
+ *    Sends large responses a slice at a time so that the rest of the
+ *    application keeps running while a transfer is in progress. A handler
+ *    supplies a WTProducer which is asked for a bounded amount of content
+ *    each time pump() is called (typically once per loop()).
+ *
+ * NOTES:
+ * o The engine writes the status line and headers itself and then takes
+ *   over the client connection from the web server. The connection is
+ *   closed when the response is complete.
+ * o If the length of the content isn't known in advance, the response is
+ *   sent using chunked transfer encoding.
+ * o Only a few responses may be in progress at once. If all of the slots
+ *   are busy, a new response is sent to completion before start() returns.
+ * o On ESP8266 a slice is only sent once the connection can take it without
+ *   blocking. The ESP32 WiFiClient can't report that, so there a write may
+ *   block until the client has acknowledged enough earlier data.
+ *
+ */
+
+#ifndef WTResponseEngine_h
+#define WTResponseEngine_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <functional>
+#include <memory>
+#include <Arduino.h>
+#if defined(ESP8266)
+  #include <ESP8266WiFi.h>
+#elif defined(ESP32)
+  #include <WiFi.h>
+#else
+  #error "Must be an ESP8266 or ESP32"
+#endif
+//                                  Third Party Libraries
+//                                  Local Includes
+#include "WTBufferedWriter.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+class WTProducer {
+public:
+  virtual ~WTProducer() { }
+
+  // Write the next slice of content.
+  // @param out       Where the content is written
+  // @param maxBytes  A producer should write roughly this many bytes. It may
+  //                  write somewhat more if that keeps its logic simple.
+  // @return true if there is more content to come, false once finished
+  virtual bool produce(Print& out, size_t maxBytes) = 0;
+};
+
+
+class WTResponseEngine {
+public:
+  // ----- Constants
+  // About one TCP segment, and a whole number of 512 byte blocks so that
+  // block structured content (e.g. tar files) is sent in whole blocks
+  static constexpr size_t   SliceSize = 3 * 512;
+  static constexpr uint8_t  MaxResponses = 2;
+  static constexpr uint32_t StallTimeout = 10000;   // ms without progress before giving up
+
+  // ----- Types
+  // Told about each response when it ends, whether or not it was completed
+  using FinishCallback = std::function<void(const String& label, uint32_t elapsedMillis, size_t bytes)>;
+
+  // ----- Member Functions
+
+  // Begin sending a response. The headers and the first slice of content are
+  // sent immediately, the remainder is sent by subsequent calls to pump().
+  // @param client    The connection to send the response on
+  // @param code      The status code and reason, e.g. "200 OK"
+  // @param type      The Content-Type
+  // @param length    The length of the content, or -1 if it is not known
+  // @param headers   Any additional header lines, each terminated by "\r\n"
+  // @param producer  Supplies the content. The engine takes ownership of it.
+  //                  May be nullptr if only the headers should be sent.
+  // @param label     Identifies the response to the FinishCallback
+  void start(
+      WiFiClient client, const String& code, const String& type, int32_t length,
+      const String& headers, WTProducer* producer, const char* label = "");
+
+  void onFinish(FinishCallback cb) { _onFinish = cb; }
+
+  // Send the next slice of each response that is in progress
+  void pump();
+
+  // The number of responses currently in progress
+  uint8_t active() const;
+
+  // The longest time (in microseconds) that a single slice has taken
+  uint32_t longestSlice() const { return _longestSlice; }
+
+private:
+  // ----- Types
+  class ClientWriter : public WTBufferedWriter<SliceSize> {
+  public:
+    ClientWriter(const WiFiClient& theClient, bool useChunks) : client(theClient), chunked(useChunks) { }
+    WiFiClient client;
+    bool chunked;
+  protected:
+    void emit(const uint8_t* data, size_t length) override;
+  };
+
+  struct Response {
+    Response(const WiFiClient& client, bool chunked, WTProducer* p) : writer(client, chunked), producer(p) { }
+    ClientWriter writer;
+    std::unique_ptr<WTProducer> producer;
+    String label;
+    uint32_t startTime;
+    uint32_t lastProgress;
+    uint32_t longestSlice = 0;
+  };
+
+  // ----- Member Functions
+  bool service(Response& r);
+  bool step(Response& r);
+  void finish(Response& r);
+  void report(const Response& r);
+
+  // ----- Data Members
+  std::unique_ptr<Response> _responses[MaxResponses];
+  uint32_t _longestSlice = 0;
+  FinishCallback _onFinish = nullptr;
+};
+
+#endif  // WTResponseEngine_h
@@ -0,0 +1,111 @@
+/*
+ * WTRouteMetrics:
+ *    Per-route measurements of request handlers
+ *
+ */
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+//                                  Third Party Libraries
+#include <GenericESP.h>
+//                                  Local Includes
+#include "WTRouteMetrics.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+WTRouteMetrics::Measurement::Measurement(
+    WTRouteMetrics& metrics, const char* route, const size_t& byteCount) :
+  _metrics(metrics), _route(route), _byteCount(byteCount)
+{
+  _startBytes = _byteCount;
+  _startHeap = GenericESP::getFreeHeap();
+  _startBlock = GenericESP::getMaxFreeBlockSize();
+  _startMicros = micros();
+}
+
+WTRouteMetrics::Measurement::~Measurement() {
+  uint32_t elapsed = micros() - _startMicros;
+  _metrics.record(
+      _route, elapsed, _byteCount - _startBytes,
+      (int32_t)(GenericESP::getFreeHeap() - _startHeap),
+      (int32_t)(GenericESP::getMaxFreeBlockSize() - _startBlock));
+}
+
+uint32_t WTRouteMetrics::Route::percentile(uint8_t p) const {
+  uint32_t total = 0;
+  for (uint16_t count : histogram) total += count;
+  if (total == 0) return 0;
+
+  uint32_t target = (total * p + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < Buckets; i++) {
+    seen += histogram[i];
+    if (seen >= target) {
+      uint32_t upperBound = (1UL << (i + FirstBucketShift)) - 1;
+      return std::min(upperBound, maxMicros);
+    }
+  }
+  return maxMicros;
+}
+
+void WTRouteMetrics::record(
+    const char* route, uint32_t elapsedMicros, uint32_t bytes,
+    int32_t heapDelta, int32_t blockDelta)
+{
+  Route& r = find(route);
+  r.hits++;
+  r.maxMicros = std::max(r.maxMicros, elapsedMicros);
+  r.bytesSent += bytes;
+  r.heapDelta += heapDelta;
+  r.worstHeapDelta = std::min(r.worstHeapDelta, heapDelta);
+  r.worstBlockDelta = std::min(r.worstBlockDelta, blockDelta);
+
+  uint8_t bucket = 0;
+  for (uint32_t t = elapsedMicros >> FirstBucketShift; t && bucket < Buckets - 1; t >>= 1) bucket++;
+  if (r.histogram[bucket] == UINT16_MAX) {
+    // Halve every bucket rather than overflow. The shape is what matters.
+    for (uint16_t& count : r.histogram) count /= 2;
+  }
+  r.histogram[bucket]++;
+}
+
+void WTRouteMetrics::recordStream(const char* route, uint32_t elapsedMillis, uint32_t bytes) {
+  Route& r = find(route);
+  r.streams++;
+  r.bytesSent += bytes;
+  r.maxStreamMillis = std::max(r.maxStreamMillis, elapsedMillis);
+}
+
+void WTRouteMetrics::toJSON(Print& out) const {
+  out.print(F("{\"routes\":["));
+  bool first = true;
+  for (const Route& r : _routes) {
+    if (!first) out.print(',');
+    first = false;
+    out.printf(
+        "{\"route\":\"%s\",\"hits\":%u,\"p50_us\":%u,\"p99_us\":%u,\"max_us\":%u,"
+        "\"bytes\":%u,\"heap_delta\":%d,\"worst_heap_delta\":%d,\"worst_block_delta\":%d,"
+        "\"streams\":%u,\"max_stream_ms\":%u}",
+        r.name.c_str(), (unsigned)r.hits, (unsigned)r.percentile(50), (unsigned)r.percentile(99),
+        (unsigned)r.maxMicros, (unsigned)r.bytesSent,
+        (int)r.heapDelta, (int)r.worstHeapDelta, (int)r.worstBlockDelta,
+        (unsigned)r.streams, (unsigned)r.maxStreamMillis);
+  }
+  out.print(F("]}"));
+}
+
+
+//
+// ----- Private Member Functions
+//
+
+WTRouteMetrics::Route& WTRouteMetrics::find(const char* route) {
+  for (Route& r : _routes) {
+    if (r.name == route) return r;
+  }
+  // The last slot is kept for "other"
+  if (_routes.size() >= MaxRoutes - 1 && strcmp(route, "other") != 0) return find("other");
+  _routes.emplace_back();
+  _routes.back().name = route;
+  return _routes.back();
+}
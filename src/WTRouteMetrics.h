@@ -0,0 +1,98 @@
+/*
+ * WTRouteMetrics:
+ *    Per-route measurements of request handlers: the number of requests,
+ *    a histogram of handler times, the bytes sent, and the change in free
+ *    heap and in the largest free block across each request.
+ *
+ * NOTES:
+ * o Handler times are counted in power-of-two buckets, so percentiles are
+ *   estimates: the upper bound of the bucket in which they fall.
+ * o Routes are added as they are first seen. Once MaxRoutes routes are
+ *   known, any others are counted together under the name "other".
+ * o A heap delta is the free heap after the request less the free heap
+ *   before it. A route whose total delta keeps falling is leaking.
+ * o Responses that are sent after the handler returns (see WTResponseEngine)
+ *   are recorded separately when they finish, see recordStream(). Their
+ *   bytes are included in bytesSent.
+ *
+ */
+
+#ifndef WTRouteMetrics_h
+#define WTRouteMetrics_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <vector>
+#include <Arduino.h>
+//                                  Third Party Libraries
+//                                  Local Includes
+//--------------- End:    Includes ---------------------------------------------
+
+
+class WTRouteMetrics {
+public:
+  // ----- Constants
+  static constexpr uint8_t MaxRoutes = 24;
+  static constexpr uint8_t Buckets = 16;
+  static constexpr uint8_t FirstBucketShift = 7;  // Bucket 0 holds times below 2^7 us
+
+  // ----- Types
+  struct Route {
+    String   name;
+    uint32_t hits = 0;
+    uint32_t maxMicros = 0;
+    uint32_t bytesSent = 0;
+    int32_t  heapDelta = 0;         // Total over all requests
+    int32_t  worstHeapDelta = 0;    // The largest drop in a single request
+    int32_t  worstBlockDelta = 0;   // The largest drop in the largest free block
+    uint16_t histogram[Buckets] = {0};
+    uint32_t streams = 0;           // Responses that finished after the handler returned
+    uint32_t maxStreamMillis = 0;   // The longest of those, start to finish
+
+    // An estimate of the given percentile of handler times in microseconds
+    uint32_t percentile(uint8_t p) const;
+  };
+
+  // Measures a request from construction to destruction
+  class Measurement {
+  public:
+    // @param metrics     Where the measurement is recorded
+    // @param route       The name of the route being handled
+    // @param byteCount   A running count of bytes sent, read at the start and end
+    Measurement(WTRouteMetrics& metrics, const char* route, const size_t& byteCount);
+    ~Measurement();
+
+  private:
+    WTRouteMetrics& _metrics;
+    const char* _route;
+    const size_t& _byteCount;
+    size_t _startBytes;
+    uint32_t _startMicros;
+    uint32_t _startHeap;
+    uint32_t _startBlock;
+  };
+
+  // ----- Member Functions
+  void record(
+      const char* route, uint32_t elapsedMicros, uint32_t bytes,
+      int32_t heapDelta, int32_t blockDelta);
+
+  // Record a response that was sent after its handler returned
+  void recordStream(const char* route, uint32_t elapsedMillis, uint32_t bytes);
+
+  // Write the metrics for all routes as a JSON object
+  void toJSON(Print& out) const;
+
+  void reset() { _routes.clear(); }
+
+  const std::vector<Route>& routes() const { return _routes; }
+
+private:
+  // ----- Member Functions
+  Route& find(const char* route);
+
+  // ----- Data Members
+  std::vector<Route> _routes;
+};
+
+#endif  // WTRouteMetrics_h
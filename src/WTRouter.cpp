@@ -0,0 +1,215 @@
+/*
+ * WTRouter:
+ *    Maps request paths (and HTTP methods) to handlers using a compact
+ *    radix trie.
+ *
+ * NOTES:
+ * o The root node has an empty label. Every other static node holds the
+ *   run of characters that distinguishes it from its siblings. No two
+ *   static siblings start with the same character.
+ *
+ */
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+//                                  Third Party Libraries
+#include <ArduinoLog.h>
+//                                  Local Includes
+#include "WTRouter.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+WTRouter::WTRouter() {
+  newNode(0, 0);  // The root
+}
+
+bool WTRouter::add(const String& pattern, HTTPMethod method, Handler handler) {
+  int16_t node = insert(pattern);
+  if (node == NoNode) {
+    Log.warning(F("WTRouter::add: Unable to add route for %s"), pattern.c_str());
+    return false;
+  }
+
+  for (int16_t r = _nodes[node].firstRoute; r != NoNode; r = _routes[r].next) {
+    if (_routes[r].method == method) {
+      _routes[r].handler = handler;
+      return true;
+    }
+  }
+
+  _routes.push_back({method, _nodes[node].firstRoute, handler});
+  _nodes[node].firstRoute = _routes.size() - 1;
+  return false;
+}
+
+WTRouter::Result WTRouter::dispatch(const String& path, HTTPMethod method) {
+  _path = &path;
+  _nCaptures = 0;
+
+  Result result = Result::NotFound;
+  int16_t node = match(0, path.c_str(), 0, 0);
+  if (node != NoNode) {
+    result = Result::MethodNotAllowed;
+    for (int16_t r = _nodes[node].firstRoute; r != NoNode; r = _routes[r].next) {
+      if (_routes[r].method == method || _routes[r].method == HTTP_ANY) {
+        _routes[r].handler();
+        result = Result::Dispatched;
+        break;
+      }
+    }
+  }
+
+  _path = nullptr;
+  _nCaptures = 0;
+  return result;
+}
+
+String WTRouter::param(const String& name) const {
+  if (_path == nullptr) return String();
+  for (uint8_t i = 0; i < _nCaptures; i++) {
+    const Node& n = _nodes[_captures[i].node];
+    if (name.length() == n.labelLength &&
+        strncmp(name.c_str(), &_labels[n.labelStart], n.labelLength) == 0) {
+      return _path->substring(_captures[i].start, _captures[i].start + _captures[i].length);
+    }
+  }
+  return String();
+}
+
+void WTRouter::compact() {
+  _nodes.shrink_to_fit();
+  _routes.shrink_to_fit();
+  _labels.shrink_to_fit();
+  Log.verbose(
+    F("WTRouter: %d routes, %d nodes, %d label bytes, %d bytes total"),
+    _routes.size(), _nodes.size(), _labels.size(), footprint());
+}
+
+size_t WTRouter::footprint() const {
+  return
+    _nodes.capacity() * sizeof(Node) +
+    _routes.capacity() * sizeof(Route) +
+    _labels.capacity();
+}
+
+
+//
+// ----- Private Member Functions
+//
+
+int16_t WTRouter::newNode(uint16_t labelStart, uint8_t labelLength) {
+  _nodes.push_back({labelStart, labelLength, NoNode, NoNode, NoNode, NoNode});
+  return _nodes.size() - 1;
+}
+
+uint16_t WTRouter::addLabel(const char* text, size_t length) {
+  uint16_t start = _labels.size();
+  _labels.insert(_labels.end(), text, text + length);
+  return start;
+}
+
+int16_t WTRouter::findChild(int16_t node, char c) const {
+  for (int16_t child = _nodes[node].firstChild; child != NoNode; child = _nodes[child].nextSibling) {
+    if (_labels[_nodes[child].labelStart] == c) return child;
+  }
+  return NoNode;
+}
+
+int16_t WTRouter::insert(const String& pattern) {
+  const char* p = pattern.c_str();
+  int len = pattern.length();
+  int pos = 0;
+  int16_t node = 0;
+
+  while (pos < len) {
+    if (p[pos] == '{') {
+      int end = pattern.indexOf('}', pos);
+      if (end == -1) return NoNode;
+      const char* name = &p[pos+1];
+      uint8_t nameLength = end - pos - 1;
+      int16_t paramNode = _nodes[node].paramChild;
+      if (paramNode == NoNode) {
+        paramNode = newNode(addLabel(name, nameLength), nameLength);
+        _nodes[node].paramChild = paramNode;
+      } else if (_nodes[paramNode].labelLength != nameLength ||
+                 strncmp(&_labels[_nodes[paramNode].labelStart], name, nameLength) != 0) {
+        Log.warning(F("WTRouter: %s renames an existing parameter, using the original name"), p);
+      }
+      node = paramNode;
+      pos = end + 1;
+      continue;
+    }
+
+    int runEnd = pattern.indexOf('{', pos);
+    if (runEnd == -1) runEnd = len;
+    if (runEnd - pos > 255) runEnd = pos + 255;
+
+    int16_t child = findChild(node, p[pos]);
+    if (child == NoNode) {
+      uint8_t runLength = runEnd - pos;
+      child = newNode(addLabel(&p[pos], runLength), runLength);
+      _nodes[child].nextSibling = _nodes[node].firstChild;
+      _nodes[node].firstChild = child;
+      node = child;
+      pos = runEnd;
+      continue;
+    }
+
+    // Find how much of the child's label we share
+    uint8_t common = 0;
+    while (common < _nodes[child].labelLength && pos + common < runEnd &&
+           _labels[_nodes[child].labelStart + common] == p[pos + common]) {
+      common++;
+    }
+
+    if (common < _nodes[child].labelLength) {
+      // Split the child. The tail takes over the child's descendants and routes
+      int16_t tail = newNode(
+          _nodes[child].labelStart + common, _nodes[child].labelLength - common);
+      Node& c = _nodes[child];
+      Node& t = _nodes[tail];
+      t.firstChild = c.firstChild;
+      t.paramChild = c.paramChild;
+      t.firstRoute = c.firstRoute;
+      c.labelLength = common;
+      c.firstChild = tail;
+      c.paramChild = NoNode;
+      c.firstRoute = NoNode;
+    }
+
+    node = child;
+    pos += common;
+  }
+
+  return node;
+}
+
+int16_t WTRouter::match(int16_t node, const char* path, uint16_t offset, uint8_t nCaptures) {
+  const char* remaining = path + offset;
+  if (*remaining == '\0') {
+    if (_nodes[node].firstRoute == NoNode) return NoNode;
+    _nCaptures = nCaptures;
+    return node;
+  }
+
+  int16_t child = findChild(node, *remaining);
+  if (child != NoNode) {
+    const Node& c = _nodes[child];
+    if (strncmp(remaining, &_labels[c.labelStart], c.labelLength) == 0) {
+      int16_t found = match(child, path, offset + c.labelLength, nCaptures);
+      if (found != NoNode) return found;
+    }
+  }
+
+  int16_t paramNode = _nodes[node].paramChild;
+  if (paramNode != NoNode && nCaptures < MaxParams) {
+    uint16_t length = 0;
+    while (remaining[length] != '\0' && remaining[length] != '/') length++;
+    if (length > 0) {
+      _captures[nCaptures] = {paramNode, offset, length};
+      return match(paramNode, path, offset + length, nCaptures + 1);
+    }
+  }
+
+  return NoNode;
+}
@@ -0,0 +1,118 @@
+/*
+ * WTRouter:
+ *    Maps request paths (and HTTP methods) to handlers using a compact
+ *    radix trie. Path patterns may include parameters of the form {name}
+ *    which match a run of characters up to the next '/'. For example:
+ *      /api/history/{range}
+ *    will match /api/history/day and make "day" available as the "range"
+ *    parameter while the handler runs.
+ *
+ * NOTES:
+ * o All node labels are stored in a single shared pool and nodes refer to
+ *   each other by index, so each additional route costs a few bytes rather
+ *   than a heap-allocated map node with its own String.
+ * o Matching does not allocate. Static children are preferred over parameter
+ *   children and matching backtracks if a static branch fails.
+ *
+ */
+
+#ifndef WTRouter_h
+#define WTRouter_h
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <functional>
+#include <vector>
+#if defined(ESP8266)
+  #include <ESP8266WebServer.h>
+#elif defined(ESP32)
+  #include <WebServer.h>
+#else
+  #error "Must be an ESP8266 or ESP32"
+#endif
+//                                  Third Party Libraries
+//                                  Local Includes
+//--------------- End:    Includes ---------------------------------------------
+
+
+class WTRouter {
+public:
+  // ----- Types
+  using Handler = std::function<void(void)>;
+  enum class Result {Dispatched, NotFound, MethodNotAllowed};
+
+  // ----- Constants
+  static constexpr uint8_t MaxParams = 4;
+
+  // ----- Constructors
+  WTRouter();
+
+  // ----- Member Functions
+
+  // Add a handler for a path pattern and method. Use HTTP_ANY to match any method.
+  // @param pattern   The path to match. May contain {name} parameters
+  // @param method    The HTTP method this handler responds to
+  // @param handler   The function to call when the pattern and method match
+  // @return true if a previously registered handler was replaced
+  bool add(const String& pattern, HTTPMethod method, Handler handler);
+
+  // Find and invoke the handler for the given path and method
+  // @param path    The path of the request (without query args)
+  // @param method  The method of the request
+  // @return Whether a handler was invoked, and if not, why not
+  Result dispatch(const String& path, HTTPMethod method);
+
+  // Returns the value of a path parameter for the request that is currently
+  // being dispatched. Returns an empty String if there is no such parameter.
+  String param(const String& name) const;
+
+  // Release any excess capacity. Typically called once all routes are added.
+  // Routes may still be added afterward.
+  void compact();
+
+  // The approximate number of bytes used by the routing structures
+  size_t footprint() const;
+
+private:
+  // ----- Types
+  static constexpr int16_t NoNode = -1;
+
+  struct Node {
+    uint16_t labelStart;    // Offset into _labels
+    uint8_t  labelLength;   // For parameter nodes, the label is the param name
+    int16_t  firstChild;    // First static child
+    int16_t  nextSibling;   // Next static sibling
+    int16_t  paramChild;    // At most one parameter child per node
+    int16_t  firstRoute;    // Index into _routes of the first handler at this node
+  };
+
+  struct Route {
+    HTTPMethod method;
+    int16_t    next;
+    Handler    handler;
+  };
+
+  struct Capture {
+    int16_t  node;
+    uint16_t start;
+    uint16_t length;
+  };
+
+  // ----- Member Functions
+  int16_t newNode(uint16_t labelStart, uint8_t labelLength);
+  uint16_t addLabel(const char* text, size_t length);
+  int16_t findChild(int16_t node, char c) const;
+  int16_t insert(const String& pattern);
+  int16_t match(int16_t node, const char* path, uint16_t offset, uint8_t nCaptures);
+
+  // ----- Data Members
+  std::vector<Node>  _nodes;
+  std::vector<Route> _routes;
+  std::vector<char>  _labels;
+
+  const String* _path = nullptr;  // Only valid during dispatch
+  uint8_t _nCaptures = 0;
+  Capture _captures[MaxParams];
+};
+
+#endif  // WTRouter_h
@@ -181,6 +181,7 @@ namespace WebThing {
     bool mDNSStarted = false;
     
     void configChanged() {
+      BaseSettings::changed();
       Internal::timeDB.init(
           settings.timeZoneDBKey, settings.lat, settings.lng);
       if (Internal::configChangeCB) Internal::configChangeCB();
@@ -231,6 +232,7 @@ namespace WebThing {
     static uint32_t lastActionTime = 0;
 
     WebUI::handleClient();
+    DataBroker::loop();
     buttonMgr.process();
 
 #if defined(ESP8266)
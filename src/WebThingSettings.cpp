@@ -82,6 +82,32 @@ void WebThingSettings::toJSON(JsonDocument &doc) {
   doc[F("showDevMenu")] = showDevMenu;
 }
 
+void WebThingSettings::visitFields(FieldVisitor& v) {
+  v.visit(F("lat"), lat);
+  v.visit(F("lng"), lng);
+  v.visit(F("elevation"), elevation);
+
+  v.visit(F("googleMapsKey"), googleMapsKey);
+  v.visit(F("timeZoneDBKey"), timeZoneDBKey);
+
+  v.visit(F("hostname"), hostname);
+  v.visit(F("webServerPort"), webServerPort, 1, 65535);
+  v.visit(F("useBasicAuth"), useBasicAuth);
+  v.visit(F("webUsername"), webUsername);
+  v.visitSecret(F("webPassword"), webPassword);
+  v.visit(F("themeColor"), themeColor);
+
+  v.visit(F("voltageCalibFactor"), voltageCalibFactor);
+  v.visit(F("useLowPowerMode"), useLowPowerMode);
+  v.visit(F("hasVoltageSensing"), hasVoltageSensing);
+  v.visit(F("processingInterval"), processingInterval, 1, LONG_MAX);
+  v.visit(F("sleepOverridePin"), sleepOverridePin);
+  v.visit(F("displayPowerOptions"), displayPowerOptions);
+
+  v.visit(F("logLevel"), logLevel, 0, 6);
+  v.visit(F("showDevMenu"), showDevMenu);
+}
+
 void WebThingSettings::logSettings() {
   Log.verbose(F("Location Settings"));
   Log.verbose(F("  lat = %F"), lat);
@@ -6,7 +6,7 @@
  * o Adding a setting is a multi-step process:
  *   1. Add a member variable to store the new setting in the class definition below
  *      Give it a default value here, or in the constructor if it needs to be computed.
- *   2. Update toJSON(), fromJSON, and logSettings() to reflect the new setting
+ *   2. Update toJSON(), fromJSON, visitFields(), and logSettings() to reflect the new setting
  *   3. Assuming the setting is configureable through a UI (the WebUI and/or others),
  *      add the interface for it. For WebUIs, this is typically in the handleConfigure()
  *      function and the handleUpdateConfig() function.
@@ -33,6 +33,7 @@ public:
   void fromJSON(const JsonDocument &doc);
   void toJSON(JsonDocument &doc);
   void logSettings();
+  void visitFields(FieldVisitor& v);
 
   // ----- Location Settings
   float  lat = 37.448237;
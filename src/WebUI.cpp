@@ -23,7 +23,6 @@
   using WebServer = ESP8266WebServer;
   #include <ESP8266mDNS.h>
 #elif defined(ESP32)
-  #include <map>
   #include <WiFi.h>
   #include <WebServer.h>
   #include <HTTPClient.h>
@@ -43,6 +42,14 @@
 #include "WebThing.h"
 #include "WebUI.h"
 #include "ESPTarWriter.h"
+#include "WTRouter.h"
+#include "TemplateCache.h"
+#include "WTCrc32.h"
+#include "WTBufferedWriter.h"
+#include "WTResponseEngine.h"
+#include "WTFileCache.h"
+#include "PageCache.h"
+#include "WTRouteMetrics.h"
 //--------------- End:    Includes ---------------------------------------------
 
 
@@ -61,22 +68,159 @@ namespace WebUI {
   // ----- BEGIN: WebUI::Internal
   namespace Internal {
     String EmptyString = "";
-    String uploadPath = "";
-    std::map<String, std::function<void(void)>> handlers;
+    WTRouter router;
+    TemplateCache templates;
+    // Request headers that WebUI itself relies upon. Any headers requested
+    // by the app via collectHeaders() are collected in addition to these.
+    const char* requiredHeaders[] = {"Accept-Encoding", "If-None-Match"};
     std::function<void(bool)> busyCallback = nullptr; 
 
+    void sendNoCacheHeaders() {
+      server->sendHeader("Cache-Control", "no-cache, no-store");
+      server->sendHeader("Pragma", "no-cache");
+      server->sendHeader("Expires", "-1");
+    }
+    // The same headers for responses whose header block is written directly
+    // rather than by the server (see WTResponseEngine)
+    const char NoCacheHeaderLines[] PROGMEM =
+      "Cache-Control: no-cache, no-store\r\nPragma: no-cache\r\nExpires: -1\r\n";
+
+    // Keep-alive state. See setKeepAlive()
+    bool keepAlive = false;
+    uint32_t keepAliveIdle = DefaultKeepAliveIdle;
+    struct {
+      IPAddress ip;
+      uint16_t port = 0;
+      uint32_t time = 0;
+    } lastResponse;
+
+    // Called once a complete response has been sent. Unless keep-alive is
+    // enabled, the connection is closed. Otherwise the client may send
+    // another request on it.
+    void endResponse() {
+      auto client = server->client();
+      client.flush();
+      if (!keepAlive) { client.stop(); return; }
+      lastResponse.ip = client.remoteIP();
+      lastResponse.port = client.remotePort();
+      lastResponse.time = millis();
+    }
+
+    // Close the current connection if it has been idle since its last
+    // response for longer than the keep-alive idle time
+    void closeIdleConnection() {
+      auto client = server->client();
+      if (!client.connected() || client.available()) return;
+      if (client.remotePort() != lastResponse.port || client.remoteIP() != lastResponse.ip) return;
+      if (millis() - lastResponse.time < keepAliveIdle) return;
+      Log.verbose(F("WebUI: Closing idle connection"));
+      client.stop();
+      lastResponse.port = 0;
+    }
+
+    // Handlers run through wrapWebAction / wrapWebPage are measured per route.
+    // bytesSent counts the content sent through WebUI, not including headers.
+    WTRouteMetrics metrics;
+    size_t bytesSent = 0;
+
+    // The route whose handler is running, if it was run by one of the wrap
+    // functions. Responses it hands to the engine are recorded under it.
+    const char* currentRoute = nullptr;
+    struct RouteScope {
+      RouteScope(const char* route) : previous(currentRoute) { currentRoute = route; }
+      ~RouteScope() { currentRoute = previous; }
+      const char* previous;
+    };
+    const char* streamLabel(const char* fallback) { return currentRoute ? currentRoute : fallback; }
+
+    // Sends buffered data as chunks of a response that was started with
+    // a content length of CONTENT_LENGTH_UNKNOWN
+    template<size_t ChunkSize>
+    class ServerWriter : public WTBufferedWriter<ChunkSize> {
+    protected:
+      void emit(const uint8_t* data, size_t length) override {
+        server->sendContent(reinterpret_cast<const char*>(data), length);
+        bytesSent += length;
+      }
+    };
+
+    // Passes everything through to a client, counting what is written
+    class CountingStream : public Stream {
+    public:
+      CountingStream(Stream& theStream) : stream(theStream) { }
+      int available() override { return stream.available(); }
+      int read() override { return stream.read(); }
+      int peek() override { return stream.peek(); }
+      void flush() override { stream.flush(); }
+      size_t write(uint8_t c) override { return count(stream.write(c)); }
+      size_t write(const uint8_t* data, size_t length) override { return count(stream.write(data, length)); }
+    private:
+      size_t count(size_t n) { bytesSent += n; return n; }
+      Stream& stream;
+    };
+
+    // Coalesces page content into (at most) MTU-sized chunks. All of the page
+    // rendering functions write through this object. It must be flushed before
+    // anything writes to the server directly.
+    constexpr size_t PageChunkSize = 1460;
+    ServerWriter<PageChunkSize> pageWriter;
+
+    // Where page content is currently being written. This is normally the
+    // pageWriter, but is redirected while a page is rendered into the page cache.
+    Print* pageOut = &pageWriter;
+
+    // Large responses are handed to the response engine which sends them
+    // a slice at a time from handleClient()
+    WTResponseEngine responses;
+
+    // Rendered pages. Disabled unless the app gives it a budget.
+    PageCache pages;
+
+    void sendTemplate(const String& path, ESPTemplateProcessor::Mapper mapper) {
+      templates.send(path, mapper, *pageOut);
+    }
+
+    void sendTemplate(const String& path, WTKeyHash::Mapper mapper) {
+      templates.send(path, mapper, *pageOut);
+    }
+
+    // Option tables for the built-in pages. See sendOptions()
+    const char ThemeOptions[] PROGMEM =
+      "red\npink\npurple\ndeep-purple\nindigo\nblue\nlight-blue\ncyan\nteal\n"
+      "green\nlight-green\nlime\nkhaki\nyellow\namber\norange\ndeep-orange\n"
+      "blue-grey\nbrown\ngrey\ndark-grey\nblack\nw3schools";
+    const char ProcessingIntervalOptions[] PROGMEM =
+      "1\n10\n15\n20\n30\n60";
+    const char SleepOverridePinOptions[] PROGMEM =
+      "-1|No Override Pin\n"
+      "0|GPIO 0 (D3)\n1|GPIO 1 (TX)\n2|GPIO 2 (D4)\n3|GPIO 3 (RX)\n4|GPIO 4 (D2)\n"
+      "5|GPIO 5 (D1)\n6|GPIO 6\n7|GPIO 7\n8|GPIO 8\n9|GPIO 9\n10|GPIO 10\n11|GPIO 11\n"
+      "12|GPIO 12 (D6)\n13|GPIO 13 (D7)\n14|GPIO 14 (D5)\n15|GPIO 15 (D8)\n16|GPIO 16 (D0)";
+
+    // Write characters from flash until reaching the end of the current field
+    // @return The delimiter that ended the field ('|', '\n', or '\0')
+    char writeOptionField(Print& out, PGM_P& p) {
+      char c;
+      while ((c = pgm_read_byte(p)) != '\0' && c != '|' && c != '\n') { out.write(c); p++; }
+      return c;
+    }
+
     void handleNotFound() {
       Log.verbose("WebUI::handleNotFound: URI = %s", server->uri().c_str());
       redirectHome();
     }
 
     void indirectHandler() {
-      auto handler = handlers.find(server->uri());
-      if (handler == handlers.end()) {
-        handleNotFound();
-        return;
+      switch (router.dispatch(server->uri(), server->method())) {
+        case WTRouter::Result::NotFound:
+          handleNotFound();
+          break;
+        case WTRouter::Result::MethodNotAllowed:
+          closeConnection(405, "405: Method Not Allowed");
+          break;
+        case WTRouter::Result::Dispatched:
+          break;
       }
-      handler->second();
     }
 
     bool authentication() {
@@ -90,56 +234,72 @@ namespace WebUI {
       return true; // Authentication not required
     }
 
-    void sendPageHeader(bool refresh = false) {
-      auto mapper =[refresh](const String &key, String& val) -> void {
-        if (key.equals(F("TITLE"))) val = title;
-        else if (key.equals(F("THEME_COLOR"))) val = WebThing::settings.themeColor;
-        else if (key.equals(F("REFRESH")) && refresh) val = "<meta http-equiv='refresh' content='90'>";
-        else if (key.equals(F("PWR_VSBL"))) val = WebThing::settings.displayPowerOptions ? "inline" : "none";
-        else if (key.equals(F("CORE_MENU_ITEMS"))) {
-          if (coreMenuItems) val = coreMenuItems;
-          else if (!additionalMenuItems.isEmpty()) val = additionalMenuItems;
+    // Send the response headers for an html page
+    void beginPage() {
+      sendNoCacheHeaders();
+      server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+      server->send(200, "text/html", "");
+      pageWriter.reset();   // Discard anything left over from an unfinished page
+    }
+
+    void sendPageHeader(bool refresh = false, Print& out = pageWriter) {
+      auto mapper =[refresh](WTKeyHash::Hash keyHash, const String &key, String& val) -> void {
+        switch (keyHash) {
+          case "TITLE"_kh: val = title; break;
+          case "THEME_COLOR"_kh: val = WebThing::settings.themeColor; break;
+          case "REFRESH"_kh: if (refresh) val = "<meta http-equiv='refresh' content='90'>"; break;
+          case "PWR_VSBL"_kh: val = WebThing::settings.displayPowerOptions ? "inline" : "none"; break;
+          case "CORE_MENU_ITEMS"_kh:
+            if (coreMenuItems) val = coreMenuItems;
+            else if (!additionalMenuItems.isEmpty()) val = additionalMenuItems;
+            break;
+          case "APP_MENU_ITEMS"_kh: if (appMenuItems) val = appMenuItems; break;
+          case "DEV_MENU_ITEMS"_kh: if (devMenuItems) val = devMenuItems; break;
         }
-        else if (key.equals(F("APP_MENU_ITEMS")) && appMenuItems) val = appMenuItems;
-        else if (key.equals(F("DEV_MENU_ITEMS")) && devMenuItems) val = devMenuItems;
       };
 
-      templateHandler->send("/wt/Header.html", mapper);
+      templates.send("/wt/Header.html", mapper, out);
     }
 
     void sendFooter() {
-      auto mapper =[](const String &key, String& val) -> void {
-        if (key.equals(F("VERSION"))) val = WebThing::getDisplayedVersion();
-        else if (key.equals(F("RSSI"))) { val.concat(WebThing::wifiQualityAsPct()); val.concat('%'); }
-        else if (key.equals(F("SLEEP_OVERRIDE")) && WebThing::settings.useLowPowerMode) {
-          val = "<span style='float:right;'><i class='fa fa-bed' aria-hidden='true'></i> Sleep Mode Override: ";
-          if (WebThing::isSleepOverrideEnabled()) val.concat("On");
-          else val.concat("Off");
-          val.concat("</span>");
+      auto mapper =[](WTKeyHash::Hash keyHash, const String &key, String& val) -> void {
+        switch (keyHash) {
+          case "VERSION"_kh: val = WebThing::getDisplayedVersion(); break;
+          case "RSSI"_kh: val.concat(WebThing::wifiQualityAsPct()); val.concat('%'); break;
+          case "SLEEP_OVERRIDE"_kh:
+            if (!WebThing::settings.useLowPowerMode) break;
+            val = "<span style='float:right;'><i class='fa fa-bed' aria-hidden='true'></i> Sleep Mode Override: ";
+            if (WebThing::isSleepOverrideEnabled()) val.concat("On");
+            else val.concat("Off");
+            val.concat("</span>");
+            break;
         }
       };
 
-      templateHandler->send("/wt/Footer.html", mapper);
-    }
-
-    void sendStringOptions(String selectedVal, String &OptionList, String &extras) {
-      String theOptions = extras + OptionList;
-      String target = ">"+selectedVal+"<";
-      theOptions.replace(target, " selected"+target);
-      sendContent(theOptions);
-    }
-
-    void sendIntOptions(int selectedVal, String &OptionList, String &extras) {
-      String theOptions = extras + OptionList;
-      String target = "'" + String(selectedVal) + "'";  // e.g. '7'
-      theOptions.replace(target, target + " selected");
-      sendContent(theOptions);
+      sendTemplate("/wt/Footer.html", mapper);
     }
   }
   // ----- END: WebUI::Internal
 
   // ----- BEGIN: WebUI::Endpoints
   namespace Endpoints {
+    // When the file system doesn't record modification times, ETags are
+    // derived from a hash of the content. This small index remembers those
+    // hashes so each file is only hashed once (or once per change in size).
+    struct HashedFile {
+      String   path;
+      size_t   size;
+      uint32_t crc;
+    };
+    constexpr size_t MaxHashedFiles = 8;
+    std::vector<HashedFile> hashedFiles;
+
+    void forgetHash(const String& path) {
+      for (auto it = hashedFiles.begin(); it != hashedFiles.end(); ++it) {
+        if (it->path == path) { hashedFiles.erase(it); return; }
+      }
+    }
+
     void handleWifiReset() {
       if (!WebUI::Internal::authentication()) { return server->requestAuthentication(); }
       Log.trace(F("Web Request: Handle WiFi Reset"));
@@ -204,80 +364,310 @@ namespace WebUI {
       wrapWebAction("updateConfig", action, true);
     }
 
+    // Uploads are written to flash a whole block at a time rather than in
+    // whatever size pieces arrive from the network
+    constexpr size_t UploadBlockSize = 4096;
+
+    class UploadWriter : public WTBufferedWriter<UploadBlockSize> {
+    public:
+      File file;
+      bool failed = false;
+    protected:
+      void emit(const uint8_t* data, size_t length) override {
+        if (file.write(data, length) != length) failed = true;
+      }
+    };
+
+    // The state of the upload in progress. Only exists during an upload.
+    struct Upload {
+      UploadWriter writer;
+      String target;      // The final path, if it was known when the upload began
+      String path;        // The path being written
+      uint32_t crc = 0;
+      uint32_t startTime;
+      bool succeeded = false;
+    };
+    std::unique_ptr<Upload> upload;
+
+    // Replace the file at dest with the file at src. Where the file system's
+    // rename replaces an existing file (e.g. LittleFS) the replacement is
+    // atomic. Otherwise dest is removed first and briefly doesn't exist.
+    bool replaceFile(const String& src, const String& dest) {
+      bool moved = ESP_FS::move(src.c_str(), dest.c_str());
+      if (!moved && ESP_FS::exists(dest)) {
+        ESP_FS::remove(dest);
+        moved = ESP_FS::move(src.c_str(), dest.c_str());
+      }
+      if (!moved) {
+        Log.warning("Failed moving %s to %s", src.c_str(), dest.c_str());
+        ESP_FS::remove(src);
+        return false;
+      }
+      Log.verbose("%s was moved to %s", src.c_str(), dest.c_str());
+      // A precompressed copy of the old content would otherwise be served in
+      // place of the new content (see sendStaticFile)
+      if (!dest.endsWith(".gz") && ESP_FS::exists(dest + ".gz")) {
+        Log.verbose("Removing stale %s.gz", dest.c_str());
+        ESP_FS::remove(dest + ".gz");
+      }
+      Internal::templates.invalidate(dest);
+      Internal::pages.invalidateAll();
+      forgetHash(dest);
+      return true;
+    }
+
     void completeUpload() {
-      String dest = server->arg("targetName");
-      // Log.verbose("completeUpload: target: %s", dest.c_str());
-      if (ESP_FS::move(Internal::uploadPath.c_str(), dest.c_str())) {
-        Log.verbose("%s was moved to %s", Internal::uploadPath.c_str(), dest.c_str());
-      } else {
-        Log.verbose("Failed moving %s to %s", Internal::uploadPath.c_str(), dest.c_str());
+      // If the target wasn't known when the upload began, the file was
+      // staged in /tmp and the target comes from the form
+      if (upload && upload->succeeded && upload->target.isEmpty()) {
+        String dest = server->arg("targetName");
+        if (!dest.isEmpty()) replaceFile(upload->path, dest);
       }
-      Internal::uploadPath.clear();
+      upload.reset();
     }
 
+    // Receives a file upload. The target path should be supplied as the
+    // targetName query arg (e.g. /upload?targetName=/wt/Header.html) so that
+    // it is known before the content arrives. The content is then written
+    // to <target>.part and moved into place once it has been received in
+    // its entirety. An optional crc32 arg (in hex) is checked against the
+    // CRC-32 of the content, and the upload is discarded if they differ.
     void handleUpload() {
-      static File fsUploadFile;
-      HTTPUpload& upload = server->upload();
-
-      if (upload.status == UPLOAD_FILE_START) {
-        // We're just getting started. Get the file name and open/create the file
-        Internal::uploadPath = upload.filename;
-        if (Internal::uploadPath.startsWith("/")) { Internal::uploadPath = "/tmp"+Internal::uploadPath; }
-        else { Internal::uploadPath = "/tmp/"+Internal::uploadPath; }
-        Log.trace("handleUpload: Final uploadTarget = %s", Internal::uploadPath.c_str());
-        fsUploadFile = ESP_FS::open(Internal::uploadPath, "w");
-      } else if (upload.status == UPLOAD_FILE_WRITE) {
+      HTTPUpload& info = server->upload();
+
+      if (info.status == UPLOAD_FILE_START) {
+        if (upload && !upload->succeeded) {
+          // The previous upload never finished, so discard what it wrote
+          Log.warning("handleUpload: Discarding unfinished %s", upload->path.c_str());
+          upload->writer.file.close();
+          ESP_FS::remove(upload->path);
+        }
+        upload.reset(new Upload());
+        upload->target = server->arg("targetName");
+        if (!upload->target.isEmpty()) {
+          upload->path = upload->target + ".part";
+        } else {
+          upload->path = info.filename;
+          if (upload->path.startsWith("/")) { upload->path = "/tmp"+upload->path; }
+          else { upload->path = "/tmp/"+upload->path; }
+        }
+        Log.trace("handleUpload: Receiving %s", upload->path.c_str());
+        upload->writer.file = ESP_FS::open(upload->path, "w");
+        upload->startTime = millis();
+        return;
+      }
+
+      if (!upload) return;
+      UploadWriter& writer = upload->writer;
+
+      if (info.status == UPLOAD_FILE_WRITE) {
         // There is data available, write it
-        if (fsUploadFile) {
-          fsUploadFile.write(upload.buf, upload.currentSize);
-          Log.trace("handleUpload: Received %d bytes", upload.currentSize);
+        if (writer.file) {
+          upload->crc = WTCrc32::update(upload->crc, info.buf, info.currentSize);
+          writer.write(info.buf, info.currentSize);
         }
-      } else if (upload.status == UPLOAD_FILE_END) {
+      } else if (info.status == UPLOAD_FILE_END) {
         // We're done. Close the file and send a response
-        if (fsUploadFile) {
-          fsUploadFile.close();
-          Log.trace("Upload succeeded, file size: %d", upload.totalSize);
+        if (!writer.file) {
+          server->send(500, "text/plain", "500: couldn't create file");
+          Internal::endResponse();
+          return;
+        }
+        writer.flush();
+        writer.file.close();
+
+        uint32_t elapsed = millis() - upload->startTime;
+        if (elapsed == 0) elapsed = 1;
+        Log.trace(
+          "handleUpload: Received %d bytes in %dms (%d bytes/sec), crc32: %08x",
+          info.totalSize, elapsed,
+          (uint32_t)(((uint64_t)info.totalSize * 1000) / elapsed), upload->crc);
+
+        String expectedCRC = server->arg("crc32");
+        if (writer.failed) {
+          ESP_FS::remove(upload->path);
+          server->send(500, "text/plain", "500: error writing file");
+        } else if (!expectedCRC.isEmpty() && strtoul(expectedCRC.c_str(), nullptr, 16) != upload->crc) {
+          Log.warning("handleUpload: CRC mismatch, discarding %s", upload->path.c_str());
+          ESP_FS::remove(upload->path);
+          server->send(400, "text/plain", "400: crc32 mismatch");
+        } else if (!upload->target.isEmpty() && !replaceFile(upload->path, upload->target)) {
+          server->send(500, "text/plain", "500: couldn't replace file");
+        } else {
+          upload->succeeded = true;
           server->sendHeader("Location", "/fslist");  // Go back to file system page
           server->send(303, "text/plain", "Redirecting...");
-        } else {
-          server->send(500, "text/plain", "500: couldn't create file");
         }
-        server->client().stop();
+        Internal::endResponse();
+      } else if (info.status == UPLOAD_FILE_ABORTED) {
+        Log.warning("handleUpload: Upload of %s was aborted", upload->path.c_str());
+        writer.file.close();
+        ESP_FS::remove(upload->path);
+        upload.reset();
       }
     }
 
 #if defined(ESP32)
-    String getContentType(String& filename) {
+    String getContentType(const String& filename) {
       for (mime::Entry e : mime::mimeTable) {
         if (filename.endsWith(e.endsWith)) { return e.mimeType; }
       }
       return mime::mimeTable[mime::maxType-1].mimeType;
     } 
 #elif defined(ESP8266)
-    String getContentType(String& filename) { return mime::getContentType(filename); } 
+    String getContentType(const String& filename) { return mime::getContentType(filename); } 
 #endif
 
+    uint32_t contentHash(File& f, const String& path) {
+      size_t size = f.size();
+      for (const HashedFile& hf : hashedFiles) {
+        if (hf.path == path && hf.size == size) return hf.crc;
+      }
+
+      uint8_t buffer[128];
+      uint32_t crc = 0;
+      size_t bytesRead;
+      while ((bytesRead = f.read(buffer, sizeof(buffer))) > 0) {
+        crc = WTCrc32::update(crc, buffer, bytesRead);
+      }
+      f.seek(0);
+
+      forgetHash(path);
+      if (hashedFiles.size() == MaxHashedFiles) hashedFiles.erase(hashedFiles.begin());
+      hashedFiles.push_back({path, size, crc});
+      return crc;
+    }
+
+    // Generate a strong ETag for a file. It is based on the size and modification
+    // time of the file if available, or the size and a hash of its content otherwise.
+    String etagFor(File& f, const String& path) {
+      char etag[32];
+      time_t lastWrite = f.getLastWrite();
+      if (lastWrite) {
+        sprintf(etag, "\"%x-%lx\"", (unsigned)f.size(), (unsigned long)lastWrite);
+      } else {
+        sprintf(etag, "\"%x-c%08x\"", (unsigned)f.size(), (unsigned)contentHash(f, path));
+      }
+      return String(etag);
+    }
+
+    // Produces the content of a file a slice at a time
+    class FileProducer : public WTProducer {
+    public:
+      FileProducer(File& f) : _f(f) { }
+      ~FileProducer() { _f.close(); }
+
+      bool produce(Print& out, size_t maxBytes) override {
+        uint8_t buffer[512];
+        size_t written = 0;
+        while (written < maxBytes) {
+          size_t bytesRead = _f.read(buffer, std::min(sizeof(buffer), maxBytes - written));
+          if (bytesRead == 0) return false;
+          out.write(buffer, bytesRead);
+          written += bytesRead;
+        }
+        return _f.available() > 0;
+      }
+
+    private:
+      File _f;
+    };
+
+    // Send an open file along with an ETag and Cache-Control header. If the
+    // client already has the current version (If-None-Match), respond with
+    // 304 Not Modified rather than sending the content again. Files larger
+    // than a single slice are sent by the response engine. In either case
+    // the file is closed once it has been sent; the caller must not close it.
+    // @param f            The file to send
+    // @param path         The path that was used to open f
+    // @param contentType  The Content-Type to report
+    // @param maxAge       Seconds the client may use its copy before checking again
+    // @param varyEncoding Whether the content depends on the Accept-Encoding header
+    void sendFile(
+        File& f, const String& path, const String& contentType, uint32_t maxAge,
+        bool varyEncoding = false)
+    {
+      String etag = etagFor(f, path);
+      String cacheControl = maxAge ? "max-age=" + String(maxAge) : String("no-cache");
+      String ifNoneMatch = server->header("If-None-Match");
+      bool notModified = (ifNoneMatch == "*" || ifNoneMatch.indexOf(etag) != -1);
+      bool gzipEncoded = path.endsWith(".gz") && contentType != "application/x-gzip";
+      bool headOnly = (server->method() == HTTP_HEAD);
+
+      if (notModified || f.size() <= WTResponseEngine::SliceSize) {
+        server->sendHeader("ETag", etag);
+        server->sendHeader("Cache-Control", cacheControl);
+        if (varyEncoding) server->sendHeader("Vary", "Accept-Encoding");
+        if (notModified) {
+          server->send(304);
+        } else if (headOnly) {
+          // The headers streamFile() would send, without the content
+          if (gzipEncoded) server->sendHeader("Content-Encoding", "gzip");
+          server->setContentLength(f.size());
+          server->send(200, contentType, "");
+        } else if (server->streamFile(f, contentType) != f.size()) {
+          Log.warning("Sent less data than expected for %s", path.c_str());
+        }
+        f.close();
+        Internal::endResponse();
+        return;
+      }
+
+      String headers = "ETag: " + etag + "\r\nCache-Control: " + cacheControl + "\r\n";
+      if (varyEncoding) headers += "Vary: Accept-Encoding\r\n";
+      if (gzipEncoded) headers += "Content-Encoding: gzip\r\n";
+      Internal::responses.start(
+          server->client(), OKReponse, contentType, f.size(), headers,
+          headOnly ? nullptr : new FileProducer(f), Internal::streamLabel("static files"));
+      if (headOnly) f.close();
+    }
+
+    // Send a file from the file system. If the client accepts gzip encoding
+    // and a precompressed version of the file (<filePath>.gz) exists, send
+    // that instead. The underlying server adds the Content-Encoding header
+    // for .gz files while the Content-Type is derived from the original name.
+    void sendStaticFile(const String& filePath, uint32_t maxAge) {
+      String contentType = getContentType(filePath);
+      String gzPath = filePath + ".gz";
+      bool acceptsGzip = server->header("Accept-Encoding").indexOf("gzip") != -1;
+
+      fs::FS* fs = ESP_FS::getFS();
+      const String* path = nullptr;
+      if (acceptsGzip && fs->exists(gzPath)) path = &gzPath;
+      else if (fs->exists(filePath)) path = &filePath;
+      else if (fs->exists(gzPath)) {
+        // The only version we have can't be sent to this client
+        closeConnection(406, "406: Only a gzip encoded version is available");
+        return;
+      }
+
+      File f;
+      if (path) f = ESP_FS::open(*path, "r");
+      if (!f) {
+        closeConnection(404, "404: File Not Found");
+        return;
+      }
+
+      sendFile(f, *path, contentType, maxAge, true);
+    }
+
     void displayFileContent() {
       auto action = []() {
 
         String filename = server->arg("file");
         if (filename.isEmpty()) {
-          server->send(404, "text/plain", "404: Requested filename is empty");
-          server->client().stop();
+          closeConnection(404, "404: Requested filename is empty");
+          return;
         }
 
         File f = ESP_FS::open(filename, "r");
         if (!f) {
-          server->send(404, "text/plain", "404: Requested file does not exist");
-          server->client().stop();
+          closeConnection(404, "404: Requested file does not exist");
+          return;
         }
 
-        String contentType = getContentType(filename);
-        if (server->streamFile(f, contentType) != f.size()) {
-          Log.warning("Sent less data than expected!");
-        }
-        server->client().stop();
-        f.close();
+        // Files may be replaced at any time, so always revalidate
+        sendFile(f, filename, getContentType(filename), NoCache);
       };
 
       wrapWebAction("displayFileContent", action, true);
@@ -302,9 +692,183 @@ namespace WebUI {
       return typeMap[countof(typeMap)-1].header;
     }
 
+    // Responses to /pass requests may be cached. See setPassCache()
+    WTFileCache passCache("/wt/pass_");
+
+    // Used to move data from the source to the client. It is allocated on
+    // first use and reused by subsequent requests.
+    constexpr size_t PassBufferSize = 1460;
+    std::unique_ptr<uint8_t[]> passBuffer;
+
+    // Streams the response to a GET from a source URL, storing a copy
+    // in the passCache along the way if it is enabled. The request is made
+    // directly on a WiFiClient rather than with HTTPClient so that the
+    // source's response headers can be read as they arrive (see poll()).
+    class PassProducer : public WTProducer {
+    public:
+      static constexpr uint32_t SourceTimeout = 5000;
+      static constexpr size_t MaxHeaderLine = 256;   // Longer lines are truncated
+
+      ~PassProducer() {
+        passCache.abort(_cache);
+        _client.stop();
+      }
+
+      // Connect to the source and send the request. Only establishing the
+      // connection blocks (for at most SourceTimeout ms).
+      // @return false if the source couldn't be reached
+      bool open(const String& url) {
+        _url = url;
+        if (!url.startsWith("http://")) {
+          Log.warning("Only http:// URLs may be passed through: %s", url.c_str());
+          return false;
+        }
+        int pathStart = url.indexOf('/', 7);
+        String host = url.substring(7, pathStart < 0 ? url.length() : (unsigned)pathStart);
+        uint16_t port = 80;
+        int colon = host.indexOf(':');
+        if (colon >= 0) {
+          port = host.substring(colon + 1).toInt();
+          host.remove(colon);
+        }
+
+        _client.setTimeout(SourceTimeout);
+        if (!_client.connect(host.c_str(), port)) {
+          Log.warning("Unable to connect to %s", url.c_str());
+          return false;
+        }
+        // HTTP/1.0 avoids chunked responses from the source
+        _client.print(F("GET "));
+        _client.print(pathStart < 0 ? "/" : url.c_str() + pathStart);
+        _client.print(F(" HTTP/1.0\r\nHost: "));
+        _client.print(host);
+        _client.print(F("\r\nConnection: close\r\n\r\n"));
+        _lastData = millis();
+        return true;
+      }
+
+      // Read as much of the source's response headers as has arrived
+      // @return 0 until the headers are complete, then the HTTP status code,
+      //         or a negative value if the source failed or timed out
+      int poll() {
+        while (_client.available()) {
+          int c = _client.read();
+          if (c < 0) break;
+          _lastData = millis();
+          if (c == '\r') continue;
+          if (c != '\n') {
+            if (_line.length() < MaxHeaderLine) _line += (char)c;
+            continue;
+          }
+
+          if (_status == 0) {
+            // The status line, e.g. HTTP/1.1 200 OK
+            int space = _line.indexOf(' ');
+            _status = (space < 0) ? 0 : _line.substring(space + 1).toInt();
+            if (_status <= 0) return -1;
+          } else if (_line.length() == 0) {
+            if (_status == HTTP_CODE_OK) _cache = passCache.beginStore(_url);
+            return _status;
+          } else if (strncasecmp(_line.c_str(), "Content-Length:", 15) == 0) {
+            _remaining = _line.substring(15).toInt();
+          }
+          _line = "";
+        }
+        if (!_client.connected() || millis() - _lastData > SourceTimeout) return -1;
+        return 0;
+      }
+
+      // The length of the source content, or -1 if the source didn't say
+      int32_t length() const { return _remaining; }
+
+      bool produce(Print& out, size_t maxBytes) override {
+        if (!passBuffer) passBuffer.reset(new uint8_t[PassBufferSize]);
+        uint8_t* buffer = passBuffer.get();
+
+        size_t written = 0;
+        while (written < maxBytes && _remaining != 0) {
+          size_t available = _client.available();
+          if (available == 0) {
+            if (!_client.connected()) return finish(_remaining == -1);
+            if (millis() - _lastData > SourceTimeout) {
+              Log.warning("Timeout while reading from %s", _url.c_str());
+              return finish(false);
+            }
+            return true;  // Wait for more data to arrive
+          }
+
+          size_t n = std::min(std::min(available, maxBytes - written), PassBufferSize);
+          if (_remaining > 0) n = std::min(n, (size_t)_remaining);
+          int bytesRead = _client.read(buffer, n);
+          if (bytesRead <= 0) return true;
+
+          out.write(buffer, bytesRead);
+          if (_cache.file) {
+            if (_cache.file.write(buffer, bytesRead) != (size_t)bytesRead ||
+                _cache.file.size() > passCache.maxBytes()) {
+              passCache.abort(_cache);
+            }
+          }
+          written += bytesRead;
+          if (_remaining > 0) _remaining -= bytesRead;
+          _lastData = millis();
+        }
+        if (_remaining == 0) return finish(true);
+        return true;
+      }
+
+    private:
+      bool finish(bool complete) {
+        if (complete) passCache.commit(_cache);
+        else passCache.abort(_cache);
+        Log.trace("Finished passing through %s", _url.c_str());
+        return false;
+      }
+
+      WiFiClient _client;
+      String _url;
+      String _line;             // The header line being read
+      int _status = 0;          // The source's status code, once known
+      int32_t _remaining = -1;
+      uint32_t _lastData = 0;
+      WTFileCache::Store _cache;
+    };
+
+    // /pass requests whose source hasn't finished sending its headers. The
+    // response to the client is started once it has. See pumpPasses().
+    struct PendingPass {
+      WiFiClient client;
+      const char* type;
+      std::unique_ptr<PassProducer> producer;
+    };
+    constexpr uint8_t MaxPendingPasses = 2;
+    std::vector<PendingPass> pendingPasses;
+    const String PassHeaders = "Cache-Control: max-age=3600\r\n";
+
+    void pumpPasses() {
+      for (auto it = pendingPasses.begin(); it != pendingPasses.end(); ) {
+        int httpCode = it->client.connected() ? it->producer->poll() : -1;
+        if (httpCode == 0) { ++it; continue; }
+
+        if (httpCode == HTTP_CODE_OK) {
+          PassProducer* producer = it->producer.release();
+          Internal::responses.start(
+              it->client, OKReponse, it->type, producer->length(), PassHeaders, producer, "/pass");
+        } else {
+          if (httpCode < 0) Log.warning("[HTTP] GET failed or timed out");
+          else Log.warning("[HTTP] GET returned %d", httpCode);
+          Internal::responses.start(
+              it->client, "502 Bad Gateway", "text/plain", 0, Internal::EmptyString, nullptr, "/pass");
+        }
+        it = pendingPasses.erase(it);
+      }
+    }
+
     //
     // Perform a GET on the "srcURL" arg and stream back the results.
     // Set the Content-Type header to a vlue corresponding to the "type" arg
+    // If the pass cache is enabled, a current copy of the response is sent
+    // rather than going back to the source.
     // Sample invocation:
     //   pass?srcURL=http://newsapi.org/v2/top-headlines?sources=abc-news%26apiKey=KEY&type=json
     //
@@ -312,51 +876,29 @@ namespace WebUI {
       String srcURL = server->arg("srcURL");
       const char* type = mapType(server->arg("type").c_str());
 
-      WiFiClient client;
-      HTTPClient httpSrc;  // Must be declared after client for correct destruction
-
-      httpSrc.begin(client, srcURL);
-      int httpCode = httpSrc.GET();
-
-      if (httpCode <= 0) {
-        Log.warning("[HTTP] GET... failed, error: %s\n", httpSrc.errorToString(httpCode).c_str());
-        httpSrc.end();
+      File cached = passCache.get(srcURL);
+      if (cached) {
+        Log.trace("Passing through %s from the cache", srcURL.c_str());
+        Internal::responses.start(
+            server->client(), OKReponse, type, cached.size(), PassHeaders, new FileProducer(cached), "/pass");
         return;
       }
 
-      // HTTP header has been sent and source server response header has been handled
-      // Log.trace("[HTTP] GET... code: %d\n", httpCode);
-
-      if (httpCode == HTTP_CODE_OK) {
-        int len = httpSrc.getSize(); // -1 when source server sends no Content-Length header
-        uint8_t buffer[512];
+      if (pendingPasses.size() == MaxPendingPasses) {
+        closeConnection(503, "503: Too many requests in progress");
+        return;
+      }
 
-        WiFiClient* src = &client;
-        auto dest = server->client();
-
-        // Send headers
-        dest.write("HTTP/1.1 200 OK\r\n");
-        dest.write("Content-Type: "); dest.write(type);
-        dest.write("Content-Type: "); dest.write(type);
-        dest.write("Cache-Control: max-age=3600");
-        dest.write("\r\n\r\n");
-
-        // Read from the source and write to the dest
-        while (httpSrc.connected() && (len > 0 || len == -1)) {
-          int bytesRead = src->readBytes(buffer, std::min((size_t)len, sizeof(buffer)));
-          // Log.verbose("bytesRead: %d", bytesRead);
-          if (!bytesRead) {
-            Log.warning("Timeout while reading from %s", srcURL.c_str());
-            break;
-          }
-          else dest.write(buffer, bytesRead);
-          if (len > 0) { len -= bytesRead; }
-        }
-        dest.stop();
-        Log.trace("Finished passing through %s", srcURL.c_str());
+      std::unique_ptr<PassProducer> producer(new PassProducer());
+      if (!producer->open(srcURL)) {
+        closeConnection(502, "502: Unable to retrieve srcURL");
+        return;
       }
 
-      httpSrc.end();
+      pendingPasses.emplace_back();
+      pendingPasses.back().client = server->client();
+      pendingPasses.back().type = type;
+      pendingPasses.back().producer = std::move(producer);
     }
 
     void handleFileList() {
@@ -367,30 +909,29 @@ namespace WebUI {
           Log.warning("Unable to enumerate /");
           delete de;
           server->send(404, "text/plain", "404: Unable to enumerate /");
-          server->client().stop();
+          Internal::endResponse();
           return;
         }
 
         startPage();
 
         String path;
-        String content(128);
-        server->sendContent("<h1>File System Listing</h1><ul style='list-style-type:none;'>");
+        Print& out = Internal::pageWriter;
+        out.print(F("<h1>File System Listing</h1><ul style='list-style-type:none;'>"));
         while (de->next(path)) {
-          content.clear();
           // Log.verbose("Found file: %s", path.c_str());
-          String content = "<li><a href='uploadPage?targetName=";
-          content += path;
-          content += "'><i class='fa fa-upload'></i></a>&nbsp;<a href='/content?file=";
-          content += path;
-          content += "'>";
-          content += path;
-          content += "</a></li>";
-          server->sendContent(content);
+          String encoded = WebThing::urlencode(path);
+          out.print(F("<li><a href='uploadPage?targetName="));
+          out.print(encoded);
+          out.print(F("'><i class='fa fa-upload'></i></a>&nbsp;<a href='/content?file="));
+          out.print(encoded);
+          out.print(F("'>"));
+          out.print(path);
+          out.print(F("</a></li>"));
         }
         delete de;
 
-        server->sendContent("</ul>");
+        out.print(F("</ul>"));
 
         finishPage();
       };
@@ -398,37 +939,28 @@ namespace WebUI {
       wrapWebAction("fileList", action, true);
     }
 
-    class ServerStream : public Print {
+    // Produces a tar file of the entire file system a slice at a time
+    class TarProducer : public WTProducer {
     public:
-      ServerStream(WebServer* theServer) { server = theServer; }
-
-      size_t write(uint8_t data) {
-        server->sendContent(reinterpret_cast<const char*>(&data), 1);
-        return 1;
+      bool produce(Print& out, size_t maxBytes) override {
+        if (!_tw) {
+          _tw.reset(new TarWriter(out));
+          if (!_tw->begin("/")) return false;
+        }
+        return _tw->writeSome(maxBytes);
       }
 
-      size_t write(const uint8_t *buffer, size_t size) {
-        server->sendContent(reinterpret_cast<const char*>(buffer), size);
-        return size;
-      }
     private:
-      WebServer* server;
+      std::unique_ptr<TarWriter> _tw;
     };
 
     void handleTar() {
       auto action = []() {
-        server->sendHeader("Cache-Control", "no-cache, no-store");
-        server->sendHeader("Pragma", "no-cache");
-        server->sendHeader("Expires", "-1");
-        server->sendHeader("content-disposition", "attachment; filename=\"ESP_FS.tar\"");
-        server->setContentLength(CONTENT_LENGTH_UNKNOWN);
-        server->send(200, "application/x-tar", "");
-
-        ServerStream serverStream(server);
-        TarWriter tw(serverStream);
-        String rootDir = "/";
-        tw.streamTarFile(rootDir);
-        server->sendContent("");  // End the response
+        String headers = FPSTR(Internal::NoCacheHeaderLines);
+        headers += "Content-Disposition: attachment; filename=\"ESP_FS.tar\"\r\n";
+        Internal::responses.start(
+            server->client(), OKReponse, "application/x-tar", -1, headers, new TarProducer(),
+            Internal::streamLabel("handleTar"));
       };
       wrapWebAction("handleTar", action, true);
     }
@@ -443,7 +975,7 @@ namespace WebUI {
     void displayHomePage() {
       auto action = []() {
         startPage();
-        server->sendContent("<h1>WebThing Home</h1>");
+        sendContent(F("<h1>WebThing Home</h1>"));
         finishPage();
       };
 
@@ -464,49 +996,61 @@ namespace WebUI {
         }
       }
 
-      auto mapper =[&target, &accept](const String &key, String& val) -> void {
-        if (key == "TARGET_NAME") val = target;
-        if (key == "ACCEPT") val = accept;
+      auto mapper =[&target, &accept](WTKeyHash::Hash keyHash, const String &key, String& val) -> void {
+        switch (keyHash) {
+          case "TARGET_NAME"_kh: val = WebThing::encodeAttr(target); break;
+          case "TARGET_URL"_kh: val = WebThing::urlencode(target); break;
+          case "ACCEPT"_kh: val = accept; break;
+        }
       };
 
       wrapWebPage("/uploadPage", "/wt/UploadPage.html", mapper);
     }
 
     void displayAdvSettings() {
-      String piTarget     = "SI" + String(WebThing::settings.processingInterval);
-      String sopPinTarget = "SP" + String(WebThing::settings.sleepOverridePin);
-
-      auto mapper =[&piTarget, &sopPinTarget](const String &key, String& val) -> void {
-        if (key == sopPinTarget) val = "selected";
-        else if (key == piTarget) val = "selected";
-        else if (key.equals(F("ULPM"))) val = checkedOrNot[WebThing::settings.useLowPowerMode];
-        else if (key.equals(F("VSENSE"))) val = checkedOrNot[WebThing::settings.hasVoltageSensing];
-        else if (key.equals(F("VCF"))) val = WebThing::settings.vcfAsString();
-        else if (key.equals(F("PWR_VSBL"))) val = WebThing::settings.displayPowerOptions ? "inline" : "none";
+      auto mapper =[](WTKeyHash::Hash keyHash, const String &key, String& val) -> void {
+        switch (keyHash) {
+          case "ULPM"_kh: val = checkedOrNot[WebThing::settings.useLowPowerMode]; break;
+          case "VSENSE"_kh: val = checkedOrNot[WebThing::settings.hasVoltageSensing]; break;
+          case "VCF"_kh: val = WebThing::settings.vcfAsString(); break;
+          case "PWR_VSBL"_kh: val = WebThing::settings.displayPowerOptions ? "inline" : "none"; break;
+          case "PI_OPTIONS"_kh:
+            sendOptions(
+              FPSTR(Internal::ProcessingIntervalOptions),
+              String(WebThing::settings.processingInterval));
+            break;
+          case "SOP_PIN_OPTIONS"_kh:
+            sendOptions(
+              FPSTR(Internal::SleepOverridePinOptions),
+              String(WebThing::settings.sleepOverridePin));
+            break;
+        }
       };
 
       if (Internal::busyCallback) Internal::busyCallback(false);
-      wrapWebPage("/displayPowerConfig", "/wt/AdvSettings.html", mapper);
+      wrapCachedWebPage("/displayPowerConfig", "/wt/AdvSettings.html", mapper, {});
     }
 
     void displayConfig() {
-      String themeTarget = "SL" + WebThing::settings.themeColor;
-
-      auto mapper =[&themeTarget](const String &key, String& val) -> void {
-        if (key.equals(F("LAT")))               val = WebThing::settings.latAsString();
-        else if (key.equals(F("LNG")))          val = WebThing::settings.lngAsString();
-        else if (key.equals(F("ELEV")))         val.concat(WebThing::settings.elevation);
-        else if (key.equals(F("GMAPS_KEY")))    val = WebThing::settings.googleMapsKey;
-        else if (key.equals(F("TZDB_KEY")))     val = WebThing::settings.timeZoneDBKey;
-        else if (key.equals(F("HOSTNAME")))     val = WebThing::settings.hostname;
-        else if (key.equals(F("SERVER_PORT")))  val.concat(WebThing::settings.webServerPort);
-        else if (key.equals(F("BASIC_AUTH")))   val = checkedOrNot[WebThing::settings.useBasicAuth];
-        else if (key.equals(F("WEB_UNAME")))    val = WebThing::settings.webUsername;
-        else if (key.equals(F("WEB_PASS")))     val = WebThing::settings.webPassword;  
-        else if (key == themeTarget)            val = "selected";
+      auto mapper =[](WTKeyHash::Hash keyHash, const String &key, String& val) -> void {
+        switch (keyHash) {
+          case "LAT"_kh:          val = WebThing::settings.latAsString(); break;
+          case "LNG"_kh:          val = WebThing::settings.lngAsString(); break;
+          case "ELEV"_kh:         val.concat(WebThing::settings.elevation); break;
+          case "GMAPS_KEY"_kh:    val = WebThing::settings.googleMapsKey; break;
+          case "TZDB_KEY"_kh:     val = WebThing::settings.timeZoneDBKey; break;
+          case "HOSTNAME"_kh:     val = WebThing::settings.hostname; break;
+          case "SERVER_PORT"_kh:  val.concat(WebThing::settings.webServerPort); break;
+          case "BASIC_AUTH"_kh:   val = checkedOrNot[WebThing::settings.useBasicAuth]; break;
+          case "WEB_UNAME"_kh:    val = WebThing::settings.webUsername; break;
+          case "WEB_PASS"_kh:     val = WebThing::settings.webPassword; break;
+          case "THEME_OPTIONS"_kh:
+            sendOptions(FPSTR(Internal::ThemeOptions), WebThing::settings.themeColor);
+            break;
+        }
       };
 
-      wrapWebPage("/displayConfig", "/wt/ConfigForm.html", mapper);
+      wrapCachedWebPage("/displayConfig", "/wt/ConfigForm.html", mapper, {});
     }
   } 
   // ----- END: WebUI::Pages
@@ -524,16 +1068,20 @@ namespace WebUI {
 
     // server->onNotFound(Internal::handleNotFound);
     server->onNotFound(Internal::indirectHandler);
+    server->collectHeaders(Internal::requiredHeaders, countof(Internal::requiredHeaders));
+    Internal::responses.onFinish([](const String& label, uint32_t elapsedMillis, size_t bytes) {
+      Internal::metrics.recordStream(label.c_str(), elapsedMillis, bytes);
+    });
 
     registerHandler("/",               Pages::displayHomePage);
     registerHandler("/config",         Pages::displayConfig);
     registerHandler("/advSettings",    Pages::displayAdvSettings);
     registerHandler("/uploadPage",     Pages::displayUploadPage);
 
-    registerStatic("/favicon.ico", "/wt/favicon.ico");
-    registerStatic("/favicon-16x16.png", "/wt/favicon-16x16.png");
-    registerStatic("/favicon-32x32.png", "/wt/favicon-32x32.png");
-    registerStatic("/apple-touch-icon.png", "/wt/favicon.ico");
+    registerStatic("/favicon.ico", "/wt/favicon.ico", CacheOneWeek);
+    registerStatic("/favicon-16x16.png", "/wt/favicon-16x16.png", CacheOneWeek);
+    registerStatic("/favicon-32x32.png", "/wt/favicon-32x32.png", CacheOneWeek);
+    registerStatic("/apple-touch-icon.png", "/wt/favicon.ico", CacheOneWeek);
 
     registerHandler("/updateconfig",   Endpoints::updateConfig);
     registerHandler("/updatePwrConfig",Endpoints::updateAdvSettings);
@@ -549,7 +1097,10 @@ namespace WebUI {
       "/upload", HTTP_POST, Endpoints::completeUpload, Endpoints::handleUpload);
 
     Dev::init();
+    SettingsAPI::init();
+    Events::init();
 
+    Internal::router.compact();
     server->begin();
     if (WebThing::Protected::mDNSStarted) {
       MDNS.addService("http", "tcp", WebThing::settings.webServerPort); // Advertise the web service
@@ -560,33 +1111,60 @@ namespace WebUI {
     }
   }
 
-  void setTitle(const String& theTitle) { title = WebThing::encodeAttr(theTitle); }
+  // Each of these changes the page header, so pages must be rendered again
+  void setTitle(const String& theTitle) { title = WebThing::encodeAttr(theTitle); BaseSettings::changed(); }
 
-  void addMenuItems(String html) { additionalMenuItems = html; }
-  void addCoreMenuItems(const __FlashStringHelper* core) { coreMenuItems = core; }
-  void addAppMenuItems(const __FlashStringHelper* app) { appMenuItems = app; }
-  void addDevMenuItems(const __FlashStringHelper* dev) { devMenuItems = dev; }
+  void addMenuItems(String html) { additionalMenuItems = html; BaseSettings::changed(); }
+  void addCoreMenuItems(const __FlashStringHelper* core) { coreMenuItems = core; BaseSettings::changed(); }
+  void addAppMenuItems(const __FlashStringHelper* app) { appMenuItems = app; BaseSettings::changed(); }
+  void addDevMenuItems(const __FlashStringHelper* dev) { devMenuItems = dev; BaseSettings::changed(); }
 
   void registerHandler(const String& path, std::function<void(void)> handler) {
-    if (Internal::handlers.find(path) != Internal::handlers.end()) {
+    registerHandler(path, HTTP_ANY, handler);
+  }
+
+  void registerHandler(const String& path, HTTPMethod method, std::function<void(void)> handler) {
+    if (Internal::router.add(path, method, handler)) {
       Log.verbose("Replacing URL handler for %s", path.c_str());
     }
-    Internal::handlers[path] = handler;
   }
 
-  void registerStatic(const char* uri, const char* filePath) {
-    server->serveStatic(uri, *ESP_FS::getFS(), filePath);
+  String pathArg(const String& name) { return Internal::router.param(name); }
+
+  void registerStatic(const char* uri, const char* filePath, uint32_t maxAge) {
+    String path(filePath);
+    auto handler = [path, maxAge]() { Endpoints::sendStaticFile(path, maxAge); };
+    registerHandler(uri, HTTP_GET, handler);
+    registerHandler(uri, HTTP_HEAD, handler);
   }
 
   void registerBusyCallback(std::function<void(bool)> bc) {
     Internal::busyCallback = bc;
   }
 
-  ESPTemplateProcessor *getTemplateHandler() { return templateHandler; }
+  ESPTemplateProcessor *getTemplateHandler() {
+    // The template handler writes directly to the server, so anything
+    // we've buffered must go out first to preserve ordering.
+    Internal::pageWriter.flush();
+    return templateHandler;
+  }
+
+  void sendTemplate(const char* htmlTemplate, ESPTemplateProcessor::Mapper mapper) {
+    Internal::sendTemplate(htmlTemplate, mapper);
+  }
+
+  void sendTemplate(const char* htmlTemplate, WTKeyHash::Mapper mapper) {
+    Internal::sendTemplate(htmlTemplate, mapper);
+  }
+
+  void setTemplateCacheSize(size_t bytes) { Internal::templates.setBudget(bytes); }
 
   // Deprecated as prep for supporitng both ESP8266 and ESP32
   // Get away from exposing the underlying server object
-  WebServer *getUnderlyingServer() { return server; }
+  WebServer *getUnderlyingServer() {
+    Internal::pageWriter.flush();
+    return server;
+  }
   
 
   /*------------------------------------------------------------------------------
@@ -595,7 +1173,24 @@ namespace WebUI {
    *
    *----------------------------------------------------------------------------*/
 
-  void handleClient() { server->handleClient(); }
+  void handleClient() {
+    server->handleClient();
+    Internal::responses.pump();
+    Endpoints::pumpPasses();
+    Events::maintain();
+    DataChannel::maintain();
+    if (Internal::keepAlive) Internal::closeIdleConnection();
+  }
+
+  void setKeepAlive(bool enabled, uint32_t idleMs) {
+#if defined(ESP8266)
+    Internal::keepAlive = enabled;
+    Internal::keepAliveIdle = idleMs;
+    server->keepAlive(enabled);
+#else
+    if (enabled) Log.warning(F("WebUI::setKeepAlive: Not supported on this platform"));
+#endif
+  }
 
   /*------------------------------------------------------------------------------
    *
@@ -605,6 +1200,8 @@ namespace WebUI {
 
   void wrapWebAction(const char* actionName, std::function<void(void)> action, bool showStatus) {
     Log.trace(F("Handling %s"), actionName);
+    WTRouteMetrics::Measurement measurement(Internal::metrics, actionName, Internal::bytesSent);
+    Internal::RouteScope routeScope(actionName);
     if (!WebUI::authenticationOK()) { return; }
 
     if (showStatus && Internal::busyCallback) Internal::busyCallback(true);
@@ -616,23 +1213,63 @@ namespace WebUI {
       const char* pageName, const char* htmlTemplate,
       ESPTemplateProcessor::Mapper mapper,
       bool showStatus)
+  {
+    auto hashedMapper = [&mapper](WTKeyHash::Hash, const String& key, String& val) { mapper(key, val); };
+    wrapWebPage(pageName, htmlTemplate, hashedMapper, showStatus);
+  }
+
+  void wrapWebPage(
+      const char* pageName, const char* htmlTemplate,
+      WTKeyHash::Mapper mapper,
+      bool showStatus)
   {
     Log.trace(F("Handling %s"), pageName);
+    WTRouteMetrics::Measurement measurement(Internal::metrics, pageName, Internal::bytesSent);
+    Internal::RouteScope routeScope(pageName);
     if (!WebUI::authenticationOK()) { return; }
 
     if (showStatus && Internal::busyCallback) Internal::busyCallback(true);
     WebUI::startPage();
-    templateHandler->send(htmlTemplate, mapper);
+    Internal::sendTemplate(htmlTemplate, mapper);
+    WebUI::finishPage();
+    if (showStatus && Internal::busyCallback) Internal::busyCallback(false);
+  }
+
+  void wrapCachedWebPage(
+      const char* pageName, const char* htmlTemplate,
+      WTKeyHash::Mapper mapper, std::initializer_list<WTKeyHash::Hash> liveKeys,
+      bool showStatus)
+  {
+    if (!Internal::pages.enabled()) {
+      wrapWebPage(pageName, htmlTemplate, mapper, showStatus);
+      return;
+    }
+
+    Log.trace(F("Handling %s"), pageName);
+    WTRouteMetrics::Measurement measurement(Internal::metrics, pageName, Internal::bytesSent);
+    Internal::RouteScope routeScope(pageName);
+    if (!WebUI::authenticationOK()) { return; }
+
+    if (showStatus && Internal::busyCallback) Internal::busyCallback(true);
+    Internal::beginPage();
+    auto render = [htmlTemplate](Print& out, WTKeyHash::Mapper& bodyMapper) {
+      Internal::pageOut = &out;
+      Internal::sendPageHeader(false, out);
+      Internal::templates.send(htmlTemplate, bodyMapper, out);
+      Internal::pageOut = &Internal::pageWriter;
+    };
+    Internal::pages.send(
+        pageName, BaseSettings::generation(), mapper, liveKeys, render, Internal::pageWriter);
     WebUI::finishPage();
     if (showStatus && Internal::busyCallback) Internal::busyCallback(false);
   }
 
+  void setPageCacheSize(size_t bytes) { Internal::pages.setBudget(bytes); }
+
+  WTRouteMetrics& metrics() { return Internal::metrics; }
+
   void startPage(bool refresh) {
-    server->sendHeader("Cache-Control", "no-cache, no-store");
-    server->sendHeader("Pragma", "no-cache");
-    server->sendHeader("Expires", "-1");
-    server->setContentLength(CONTENT_LENGTH_UNKNOWN);
-    server->send(200, "text/html", "");
+    Internal::beginPage();
     Internal::sendPageHeader(refresh);
   }
 
@@ -648,7 +1285,10 @@ namespace WebUI {
   const String argName(int i)  { return server->argName(i); }
 
   void collectHeaders(const char* headerKeys[], const size_t headerKeysCount) {
-    server->collectHeaders(headerKeys, headerKeysCount);
+    constexpr size_t nRequired = countof(Internal::requiredHeaders);
+    std::vector<const char*> allKeys(Internal::requiredHeaders, Internal::requiredHeaders + nRequired);
+    allKeys.insert(allKeys.end(), headerKeys, headerKeys + headerKeysCount);
+    server->collectHeaders(allKeys.data(), allKeys.size());
   }
   String header(const String& name) { return server-> header(name); }
   String header(int i) {return server->header(i); }
@@ -656,57 +1296,116 @@ namespace WebUI {
   int headers() { return server->headers(); }
   bool hasHeader(const String& name) { return server->hasHeader(name); }
 
-  void sendContent(const String &content) {
-    static const int ChunkSize = 512;
-    int length = content.length();
-    if (length < ChunkSize) { server->sendContent(content); return; }
-    for (int index = 0; index < length; index += ChunkSize) {
-      String chunk = content.substring(index, index+ChunkSize);
-      server->sendContent(chunk);
+  void sendContent(const String &content) { Internal::pageOut->print(content); }
+  void sendContent(const char* content) { Internal::pageOut->print(content); }
+  void sendContent(const __FlashStringHelper* content) { Internal::pageOut->print(content); }
+
+  void sendOptions(const __FlashStringHelper* table, const String& selected) {
+    Print& out = *Internal::pageOut;
+    PGM_P p = reinterpret_cast<PGM_P>(table);
+    while (pgm_read_byte(p)) {
+      // Write the value, comparing it to the selected value along the way
+      PGM_P value = p;
+      out.print(F("<option value='"));
+      Internal::writeOptionField(out, p);
+      size_t length = p - value;
+      bool isSelected = (length == selected.length());
+      for (size_t i = 0; isSelected && i < length; i++) {
+        isSelected = (pgm_read_byte(value + i) == selected[i]);
+      }
+      out.print(isSelected ? F("' selected>") : F("'>"));
+
+      // Write the label, which is the value unless one was given
+      if (pgm_read_byte(p) == '|') p++;
+      else p = value;
+      if (Internal::writeOptionField(out, p) == '|') {
+        while (pgm_read_byte(p) && pgm_read_byte(p) != '\n') p++;  // Malformed, skip the rest
+      }
+      out.print(F("</option>"));
+      if (pgm_read_byte(p) == '\n') p++;
     }
   }
 
   void redirectHome() {
     server->sendHeader("Location", String("/"), true);
-    server->sendHeader("Cache-Control", "no-cache, no-store");
-    server->sendHeader("Pragma", "no-cache");
-    server->sendHeader("Expires", "-1");
+    Internal::sendNoCacheHeaders();
     server->send(302, "text/plain", "");
-    server->client().stop();
+    Internal::endResponse();
   }
 
   void finishPage() {
     Internal::sendFooter();
+    Internal::pageWriter.flush();
     server->sendContent("");
-    server->client().flush();
-    server->client().stop();
+    Internal::endResponse();
   }
 
   void closeConnection(uint16_t code, String text) {
     server->send(code, "text/plain", text);
-    server->client().stop();
+    Internal::bytesSent += text.length();
+    Internal::endResponse();
   }
 
   const String OKReponse = "200 OK";
 
-  void sendJSONContent(DynamicJsonDocument *doc, const String& code) {
-    auto cp = [doc](Stream &s) { serializeJsonPretty(*doc, s); };
-    sendArbitraryContent("application/json", measureJsonPretty(*doc), cp, code);
+  void sendJSONContent(DynamicJsonDocument *doc, const String& code, JSONStyle style) {
+    if (server->hasArg(F("pretty"))) {
+      String pretty = server->arg(F("pretty"));
+      if (pretty != "0" && pretty != "false") style = JSONStyle::Pretty;
+      else if (style == JSONStyle::Pretty) style = JSONStyle::Compact;
+    }
+
+    switch (style) {
+      case JSONStyle::Pretty: {
+        auto cp = [doc](Stream &s) { serializeJsonPretty(*doc, s); };
+        sendArbitraryContent("application/json", measureJsonPretty(*doc), cp, code);
+        break;
+      }
+      case JSONStyle::Compact: {
+        auto cp = [doc](Stream &s) { serializeJson(*doc, s); };
+        sendArbitraryContent("application/json", measureJson(*doc), cp, code);
+        break;
+      }
+      case JSONStyle::Chunked:
+        server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+        server->send(code.toInt(), "application/json", "");
+        Internal::pageWriter.reset();
+        serializeJson(*doc, Internal::pageWriter);
+        Internal::pageWriter.flush();
+        server->sendContent("");
+        Internal::endResponse();
+        break;
+    }
   }
 
   void sendArbitraryContent(String type, int32_t length, ContentProvider cp, const String& code) {
+    // Without a length, the end of the content can only be signaled by
+    // closing the connection, so keep-alive is only possible with a length
+    bool persistent = Internal::keepAlive && length > 0;
     auto client = server->client();
-    client.print("HTTP/1.0 "); client.println(code);
+    client.print(persistent ? F("HTTP/1.1 ") : F("HTTP/1.0 ")); client.println(code);
     client.print(F("Content-Type: ")); client.println(type);
-    client.println(F("Connection: close"));
+    client.println(persistent ? F("Connection: keep-alive") : F("Connection: close"));
     if (length > 0) {
       client.print(F("Content-Length: "));
       client.println(length);
     }
     client.println();
 
-    cp(client);     // Send the arbitrary data
-    client.stop();  // Disconnect
+    Internal::CountingStream counted(client);
+    cp(counted);    // Send the arbitrary data
+    if (persistent) Internal::endResponse();
+    else client.stop();  // Disconnect
+  }
+
+  void setPassCache(uint32_t ttl, size_t maxBytes) {
+    Endpoints::passCache.configure(ttl, maxBytes);
+  }
+
+  void sendResumable(String type, int32_t length, WTProducer* producer, const String& code) {
+    Internal::responses.start(
+        server->client(), code, type, length, Internal::EmptyString, producer,
+        Internal::streamLabel("other"));
   }
 
   void sendStringContent(String type, String payload, const String& code) {
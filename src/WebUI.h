@@ -23,12 +23,27 @@
 #include <ESPTemplateProcessor.h>
 //                                  Local Includes
 #include "BaseSettings.h"
+#include "WTResponseEngine.h"
+#include "WTKeyHash.h"
+#include "WTRouteMetrics.h"
 //--------------- End:    Includes ---------------------------------------------
 
 
 namespace WebUI {
   constexpr const char* checkedOrNot[2] = {"", "checked='checked'"};
 
+  // Cache lifetimes (in seconds) that may be used with registerStatic()
+  constexpr uint32_t NoCache = 0;   // The client must revalidate its copy on each use
+  constexpr uint32_t CacheOneHour = 60 * 60;
+  constexpr uint32_t CacheOneDay = 24 * CacheOneHour;
+  constexpr uint32_t CacheOneWeek = 7 * CacheOneDay;
+
+  // Default time (in ms) that an idle keep-alive connection is held open
+  constexpr uint32_t DefaultKeepAliveIdle = 2000;
+
+  // Default limit on the total size of responses held by the /pass cache
+  constexpr size_t DefaultPassCacheSize = 64 * 1024;
+
   // ----- Setup functions
 
   // Call only once to initialize the web interface
@@ -41,16 +56,29 @@ namespace WebUI {
 
   // Add a handler for a new endpoint. Unlike a call to server.on(), WebUI
   // keeps track of the mapping between paths and handlers. If you call
-  // registerHandler twice for the same path, it will override the old
-  // handler with the new one.
+  // registerHandler twice for the same path (and method), it will override
+  // the old handler with the new one.
+  // The path may contain parameters of the form {name}, e.g. /api/history/{range}
+  // Each parameter matches everything up to the next '/'. While the handler is
+  // running, the matched value is available using pathArg().
   // @param path      The URL path to look for
+  // @param method    The HTTP method to respond to. The variant without a method
+  //                  responds to any method (HTTP_ANY)
   // @param handler   The function to be called when the path is requested
   void registerHandler(const String& path, std::function<void(void)> handler);
+  void registerHandler(const String& path, HTTPMethod method, std::function<void(void)> handler);
 
-  // Declare that static content (a file) is available at a given URI.
+  // Declare that static content (a file) is available at a given URI. Both GET
+  // and HEAD requests are answered. Unlike WebServer::serveStatic(), filePath
+  // must name a single file rather than a directory. If a precompressed version of the file exists (filePath + ".gz") it will
+  // be served to clients that accept gzip encoding. See tools/compress_assets.sh
+  // Responses carry an ETag so clients can make conditional requests. If their
+  // copy is current they will receive a 304 (Not Modified) with no content.
   // @param uri      The URI to respond to
   // @param filePath The file to be served in response to the URI
-  void registerStatic(const char* uri, const char* filePath);
+  // @param maxAge   How long (in seconds) the client may use its copy before
+  //                 checking with the server again. NoCache means always check.
+  void registerStatic(const char* uri, const char* filePath, uint32_t maxAge = NoCache);
 
   // If you'd like to know when WebThing starts and finishes processing a web request,
   // register a function here.
@@ -59,6 +87,16 @@ namespace WebUI {
   //                  when it ends.
   void registerBusyCallback(std::function<void(bool)> handler);
 
+  // The /pass endpoint fetches content from another server on behalf of the
+  // client. Responses may be kept in the file system so that repeated requests
+  // for the same srcURL (e.g. from several browsers) are answered by the device
+  // until they expire. The cache is disabled by default. Calling this function
+  // discards anything that is currently cached.
+  // @param ttl       How long (in seconds) a cached response may be used.
+  //                  0 disables the cache.
+  // @param maxBytes  The maximum total size of the cached responses
+  void setPassCache(uint32_t ttl, size_t maxBytes = DefaultPassCacheSize);
+
   // ----- Registering Menu Items
   // The overall "hamburger" menu is composed of three sets of menu items:
   // 1. Core: These items correspond to functionality that tends to be common across use cases
@@ -83,28 +121,93 @@ namespace WebUI {
   // Needs to be called from loop() to handle connections
   void handleClient();
 
+  // By default each connection is closed once its response has been sent.
+  // With keep-alive enabled, responses are framed with a Content-Length or
+  // chunked encoding and the client may send further requests on the same
+  // connection. A connection that stays idle for idleMs is closed. The web
+  // server core also limits how long it will wait (HTTP_MAX_CLOSE_WAIT), and
+  // it always closes the connection when another client is waiting.
+  // Currently only supported on the ESP8266.
+  // @param enabled   Whether connections should be kept open
+  // @param idleMs    How long an idle connection is held open
+  void setKeepAlive(bool enabled, uint32_t idleMs = DefaultKeepAliveIdle);
+
   // ----- Page rendering functions
   // To generate a response to a request, call:
   // 1. startPage(): Sends headers and beginning of html page
   // 2. sendContent(): Sends whatever content has been created for the body of the page
-  //    this can be called multiple times
-  // 3. finishPage(): Sends the close of the html page and stops the connection
+  //    this can be called multiple times. Content is coalesced into MTU-sized chunks
+  //    so many small calls are no more expensive on the network than one large one.
+  // 3. finishPage(): Sends the close of the html page and ends the response. The
+  //    connection is closed unless keep-alive is enabled (see setKeepAlive())
   void startPage(bool refresh = false);
   void sendContent(const String &content);
+  void sendContent(const char* content);
+  void sendContent(const __FlashStringHelper* content);
   void finishPage();
 
+  // Send the <option> elements for a <select>, marking the selected one. Typically
+  // called from a mapper for a placeholder that sits inside a <select> element.
+  // The options come from a table in flash which is streamed directly to the
+  // page. The table is a single string with one option per line. Each line is
+  // either "value" or "value|label". For example:
+  //   const char PinOptions[] PROGMEM = "-1|None\n0|GPIO 0 (D3)\n2|GPIO 2 (D4)";
+  //   sendOptions(FPSTR(PinOptions), String(settings.pin));
+  // @param table     The options, stored in flash (PROGMEM)
+  // @param selected  The value of the option that should be selected
+  void sendOptions(const __FlashStringHelper* table, const String& selected);
+
   void redirectHome();
   void closeConnection(uint16_t code, String text);
   bool authenticationOK();
 
   ESPTemplateProcessor *getTemplateHandler();
 
+  // Send the content of an html template, substituting values for each %KEY%
+  // using the supplied mapper. Parsed templates are cached so that subsequent
+  // requests need not re-read or re-scan the file. Typically called between
+  // startPage() and finishPage().
+  // @param htmlTemplate  The path of the template in the file system
+  // @param mapper        Provides the value for each key in the template
+  void sendTemplate(const char* htmlTemplate, ESPTemplateProcessor::Mapper mapper);
+
+  // As above, but the mapper is also given a compile-time-comparable hash of
+  // each key so it can dispatch with a switch rather than a chain of compares.
+  // This is much faster for templates with many keys. See WTKeyHash.h
+  void sendTemplate(const char* htmlTemplate, WTKeyHash::Mapper mapper);
+
+  // Set the number of bytes of RAM that may be used to hold parsed templates.
+  // Templates which don't fit are parsed as they are streamed from the file system.
+  void setTemplateCacheSize(size_t bytes);
+
   void wrapWebAction(
       const char* actionName, std::function<void(void)> action,
       bool showStatus = true);
   void wrapWebPage(
       const char* pageName, const char* htmlTemplate,
       ESPTemplateProcessor::Mapper mapper, bool showStatus = true);
+  void wrapWebPage(
+      const char* pageName, const char* htmlTemplate,
+      WTKeyHash::Mapper mapper, bool showStatus = true);
+
+  // Like wrapWebPage(), but for pages whose content only changes when the
+  // settings change. If the page cache is enabled (see setPageCacheSize()),
+  // the rendered page is kept and sent as is until the settings generation
+  // changes (see BaseSettings::generation()). The footer is always rendered.
+  // @param liveKeys  Keys whose values must be mapped each time the page is
+  //                  sent, e.g. {"HEAP"_kh}
+  void wrapCachedWebPage(
+      const char* pageName, const char* htmlTemplate,
+      WTKeyHash::Mapper mapper, std::initializer_list<WTKeyHash::Hash> liveKeys,
+      bool showStatus = true);
+
+  // Set the number of bytes of RAM that may be used to hold rendered pages
+  // for wrapCachedWebPage(). The default is 0, which disables the cache.
+  void setPageCacheSize(size_t bytes);
+
+  // Measurements of each route handled through wrapWebAction(), wrapWebPage(),
+  // or wrapCachedWebPage(). Available as JSON at /dev/metrics.
+  WTRouteMetrics& metrics();
 
 
   // ---------- Helper functions that isolate your code from the underlying server object
@@ -114,6 +217,7 @@ namespace WebUI {
   const String arg(const String& name);     // get request argument value by name
   const String arg(int i);                  // get request argument value by number
   const String argName(int i);              // get request argument name by number
+  String pathArg(const String& name);       // get a {name} path parameter of the current request
 
   // ----- Response Headers
   void collectHeaders(const char* headerKeys[], const size_t headerKeysCount); // set the request headers to collect
@@ -128,7 +232,28 @@ namespace WebUI {
   using ContentProvider = std::function<void(Stream&)>;
   void sendArbitraryContent(String type, int32_t length, ContentProvider cp, const String& code = OKReponse);
   void sendStringContent(String type, String payload, const String& code = OKReponse);
-  void sendJSONContent(DynamicJsonDocument *doc, const String& code = OKReponse);
+
+  // How sendJSONContent() writes a document:
+  //   Pretty   Indented for people. The document is measured, then sent with a length.
+  //   Compact  Without whitespace. The document is measured, then sent with a length.
+  //   Chunked  Without whitespace. The document is serialized once, as it is sent,
+  //            using chunked transfer encoding. Best for large or frequently polled documents.
+  // A request may override the style with a query argument: ?pretty or ?pretty=1
+  // selects Pretty, ?pretty=0 selects Compact in place of Pretty.
+  enum class JSONStyle {Pretty, Compact, Chunked};
+  void sendJSONContent(
+      DynamicJsonDocument *doc, const String& code = OKReponse,
+      JSONStyle style = JSONStyle::Pretty);
+
+  // Send a large response without stalling loop(). Rather than sending all of
+  // the content at once, the producer is asked for the next slice of content
+  // each time handleClient() is called.
+  // @param type      The Content-Type of the response
+  // @param length    The length of the content, or -1 if it isn't known in advance
+  // @param producer  Supplies the content. WebUI takes ownership and deletes it
+  //                  once the response is complete.
+  // @param code      The status code and reason
+  void sendResumable(String type, int32_t length, WTProducer* producer, const String& code = OKReponse);
 
   // Deprecated as prep for supporitng both ESP8266 and ESP32
   WebServer* getUnderlyingServer();
@@ -159,6 +284,70 @@ namespace WebUI {
     // @param   buttonAction The Action that describe the button to be added to the Dev page
     void addButton(ButtonDesc&& buttonAction);
   }
+
+  namespace Events {
+    constexpr uint8_t MaxSubscribers = 4;
+    constexpr uint32_t KeepAliveInterval = 15 * 1000L;  // Send a comment if idle this long
+
+    // Provide a Server-Sent Events stream at /events. A page can listen for
+    // new readings rather than reloading itself periodically:
+    //    new EventSource('/events').addEventListener('weather', e => { ... })
+    // Up to MaxSubscribers connections are kept open at once.
+    void init();
+
+    // Send an event to every subscriber. The data is sent as a single
+    // "data:" line, so it must not contain newlines (compact JSON is fine).
+    // @param event   The name of the event, e.g. "weather"
+    // @param data    The data carried by the event
+    void publish(const char* event, const String& data);
+    void publish(const char* event, const JsonDocument& doc);
+
+    // Lets producers skip building an event when no one is listening
+    bool hasSubscribers();
+
+    // Called by handleClient(). Drops closed connections and keeps idle ones open.
+    void maintain();
+  }
+
+  namespace DataChannel {
+    constexpr uint16_t DefaultPort = 81;
+    constexpr uint8_t MaxClients = 2;
+    constexpr uint8_t MaxKeysPerClient = 8;
+    constexpr uint32_t DefaultInterval = 1000;  // ms between checks of a subscribed key
+    constexpr uint32_t MinInterval = 250;
+
+    // Start a WebSocket server through which clients subscribe to DataBroker
+    // keys. A client sends JSON messages of the form:
+    //    {"sub": ["$S.heap", "$W.temp"], "ms": 5000}
+    //    {"unsub": ["$S.heap"]}
+    // Each subscribed key is checked no more often than every "ms" milliseconds
+    // and its value is pushed only when it has changed:
+    //    {"$S.heap": "Heap: Free=23816, Frag=4%"}
+    // If basic auth is enabled, the client must supply the credentials in an
+    // Authorization header.
+    void begin(uint16_t port = DefaultPort);
+
+    // Called by handleClient(). Accepts connections, reads messages, and pushes changes.
+    void maintain();
+  }
+
+  namespace SettingsAPI {
+    // Provide a JSON API for reading and updating settings without a browser:
+    //    GET   /api/settings           Returns the WebThing settings
+    //    PATCH /api/settings           Updates only the settings named in the
+    //                                  (flat) JSON object in the request body
+    //    GET   /api/settings/{name}    The same for settings registered using add()
+    //    PATCH /api/settings/{name}
+    // Only the fields presented by BaseSerializer::visitFields() are available.
+    void init();
+
+    // Make a settings object available through the settings API
+    // @param name      The {name} used to address the settings
+    // @param settings  The settings. Updated settings are written before
+    //                  onChange is called.
+    // @param onChange  Called after the settings have been updated. May be nullptr.
+    void add(const String& name, BaseSettings* settings, std::function<void(void)> onChange = nullptr);
+  }
 }
 
 #endif  // WebUI_h
\ No newline at end of file
@@ -0,0 +1,401 @@
+/*
+ * WebUIDataChannel:
+ *    A WebSocket server through which clients subscribe to DataBroker keys
+ *    and are sent new values as they change, rather than polling /dev/data.
+ *
+ * NOTES:
+ * o Only what this channel needs of RFC 6455 is implemented: unfragmented
+ *   text messages from the client (up to MaxMessage bytes), ping, and close.
+ * o The upgrade request is read as it arrives, so a slow or idle client
+ *   doesn't hold up loop(). Credentials, if required, must be supplied in
+ *   the request's Authorization header.
+ * o The channel listens on its own port rather than upgrading connections
+ *   accepted by the web server. The web server would otherwise go on
+ *   reading the socket (e.g. when keep-alive is enabled) and treat
+ *   WebSocket frames as HTTP requests.
+ * o The value of a key is remembered as a hash, so a subscription costs the
+ *   key plus a few words regardless of the size of the value.
+ * o Keys that producers mark dirty (see DataBroker::markDirty) are checked
+ *   as soon as MinInterval allows rather than waiting for their interval.
+ *
+ */
+
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <algorithm>
+#include <vector>
+#include <base64.h>
+#include <StreamString.h>
+#if defined(ESP8266)
+  #include <Hash.h>
+#elif defined(ESP32)
+  #include <mbedtls/sha1.h>
+  #include <mbedtls/version.h>
+#endif
+//                                  Third Party Libraries
+#include <ArduinoJson.h>
+#include <ArduinoLog.h>
+//                                  Local Includes
+#include "DataBroker.h"
+#include "WTBufferedWriter.h"
+#include "WTJson.h"
+#include "WTKeyHash.h"
+#include "WebThing.h"
+#include "WebUI.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+
+// ----- BEGIN: WebUI namespace
+namespace WebUI {
+
+  namespace DataChannel {
+    constexpr size_t MaxMessage = 256;          // Largest message accepted from a client
+    constexpr uint32_t HandshakeTimeout = 2000;   // ms for the whole upgrade request
+    constexpr size_t MaxHeaderLine = 128;         // Longer header lines are truncated
+    const char WebSocketGUID[] PROGMEM = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+    enum Opcode : uint8_t {Text = 0x1, Close = 0x8, Ping = 0x9, Pong = 0xA};
+    enum CloseCode : uint16_t {Normal = 1000, ProtocolError = 1002, Unsupported = 1003, TooBig = 1009};
+
+    struct Subscription {
+      String key;
+      DataBroker::Handle handle;
+      uint32_t interval;
+      uint32_t lastChecked = 0;
+      uint32_t hash = 0;      // Hash of the value most recently sent
+      bool sent = false;      // Nothing has been sent yet, so send the first value
+      bool changed = false;   // The key was marked dirty since it was last checked
+    };
+
+    struct Client {
+      WiFiClient client;
+      bool active = false;          // The slot holds a connection
+      bool upgraded = false;        // The WebSocket handshake is complete
+      uint32_t since = 0;           // When the connection was accepted
+      String line, key, credentials;  // Handshake state, released once upgraded
+      std::vector<Subscription> subs;
+      uint8_t rx[MaxMessage + 8];   // Room for the largest frame we accept
+      size_t rxLength = 0;
+    };
+
+    WiFiServer* listener = nullptr;
+    Client clients[MaxClients];
+
+    // Frames are written in one piece so the header and payload share a packet
+    class FrameWriter : public WTBufferedWriter<MaxMessage + 4> {
+    public:
+      WiFiClient* client = nullptr;
+      bool failed = false;
+    protected:
+      void emit(const uint8_t* data, size_t length) override {
+        if (client->write(data, length) != length) failed = true;
+      }
+    };
+    FrameWriter frameWriter;
+
+    //
+    // ----- Connections
+    //
+
+    void drop(Client& c) {
+      Log.verbose(F("DataChannel: Dropping %s"), c.client.remoteIP().toString().c_str());
+      c.client.stop();
+      c.client = WiFiClient();
+      c.subs.clear();
+      c.subs.shrink_to_fit();
+      c.rxLength = 0;
+      c.active = false;
+      c.upgraded = false;
+      c.line = c.key = c.credentials = String();
+    }
+
+    bool sendFrame(Client& c, uint8_t opcode, const char* data, size_t length) {
+      frameWriter.client = &c.client;
+      frameWriter.failed = false;
+      frameWriter.write(0x80 | opcode);   // FIN + opcode
+      if (length < 126) {
+        frameWriter.write((uint8_t)length);
+      } else {
+        frameWriter.write(126);
+        frameWriter.write((uint8_t)(length >> 8));
+        frameWriter.write((uint8_t)(length & 0xFF));
+      }
+      frameWriter.write((const uint8_t*)data, length);
+      frameWriter.flush();
+      if (frameWriter.failed) { drop(c); return false; }
+      return true;
+    }
+
+    void close(Client& c, uint16_t code) {
+      char payload[2] = {(char)(code >> 8), (char)(code & 0xFF)};
+      sendFrame(c, Close, payload, sizeof(payload));
+      if (c.active) drop(c);
+    }
+
+    String acceptKeyFor(const String& key) {
+      String combined = key + FPSTR(WebSocketGUID);
+      uint8_t digest[20];
+#if defined(ESP8266)
+      sha1(combined, digest);
+      return base64::encode(digest, sizeof(digest), false);
+#else
+  #if MBEDTLS_VERSION_MAJOR >= 3
+      mbedtls_sha1((const unsigned char*)combined.c_str(), combined.length(), digest);
+  #else
+      mbedtls_sha1_ret((const unsigned char*)combined.c_str(), combined.length(), digest);
+  #endif
+      return base64::encode(digest, sizeof(digest));
+#endif
+    }
+
+    // The same rules as WebUI::Internal::authentication()
+    bool authorized(const String& credentials) {
+      if (!WebThing::settings.useBasicAuth              ||
+          WebThing::settings.webUsername.length() == 0 ||
+          WebThing::settings.webPassword.length() == 0) {
+        return true;  // Authentication not required
+      }
+      String expected = WebThing::settings.webUsername + ':' + WebThing::settings.webPassword;
+#if defined(ESP8266)
+      return credentials == base64::encode(expected, false);
+#else
+      return credentials == base64::encode(expected);
+#endif
+    }
+
+    void reject(Client& c, const __FlashStringHelper* status) {
+      c.client.print(F("HTTP/1.1 ")); c.client.print(status);
+      c.client.print(F("\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"));
+      drop(c);
+    }
+
+    // Give a new connection a slot. Its upgrade request is read by maintain().
+    void accept(WiFiClient client) {
+      Client* slot = nullptr;
+      for (Client& c : clients) {
+        if (!c.active) { slot = &c; break; }
+      }
+      if (!slot) {
+        client.print(F("HTTP/1.1 503 Service Unavailable\r\nConnection: close\r\nContent-Length: 0\r\n\r\n"));
+        client.stop();
+        return;
+      }
+
+      client.setNoDelay(true);
+      slot->client = client;
+      slot->active = true;
+      slot->upgraded = false;
+      slot->since = millis();
+    }
+
+    void completeHandshake(Client& c) {
+      if (c.key.length() == 0) { reject(c, F("400 Bad Request")); return; }
+      if (!authorized(c.credentials)) { reject(c, F("401 Unauthorized")); return; }
+
+      c.client.print(F(
+        "HTTP/1.1 101 Switching Protocols\r\n"
+        "Upgrade: websocket\r\n"
+        "Connection: Upgrade\r\n"
+        "Sec-WebSocket-Accept: "));
+      c.client.print(acceptKeyFor(c.key));
+      c.client.print(F("\r\n\r\n"));
+
+      c.upgraded = true;
+      c.line = c.key = c.credentials = String();
+      Log.verbose(F("DataChannel: New client %s"), c.client.remoteIP().toString().c_str());
+    }
+
+    // Read whatever part of the upgrade request has arrived, a line at a time
+    void readHandshake(Client& c, uint32_t now) {
+      while (c.client.available() > 0) {
+        int ch = c.client.read();
+        if (ch < 0) break;
+        if (ch == '\r') continue;
+        if (ch != '\n') {
+          if (c.line.length() < MaxHeaderLine) c.line += (char)ch;
+          continue;
+        }
+
+        if (c.line.length() == 0) { completeHandshake(c); return; }
+        int colon = c.line.indexOf(':');
+        if (colon > 0) {   // The request line has no header name
+          String name = c.line.substring(0, colon);
+          name.toLowerCase();
+          String value = c.line.substring(colon + 1);
+          value.trim();
+          if (name == "sec-websocket-key") c.key = value;
+          else if (name == "authorization" && value.startsWith(F("Basic "))) c.credentials = value.substring(6);
+        }
+        c.line = "";
+      }
+
+      if (now - c.since > HandshakeTimeout) {
+        Log.verbose(F("DataChannel: Handshake timed out"));
+        drop(c);
+      }
+    }
+
+    //
+    // ----- Messages from the client
+    //
+
+    void sendError(Client& c, const __FlashStringHelper* message) {
+      String json = F("{\"error\":\"");
+      json += message;
+      json += F("\"}");
+      sendFrame(c, Text, json.c_str(), json.length());
+    }
+
+    void subscribe(Client& c, const char* key, uint32_t interval) {
+      for (Subscription& s : c.subs) {
+        if (s.key == key) { s.interval = interval; return; }
+      }
+      if (c.subs.size() == MaxKeysPerClient) { sendError(c, F("Too many keys")); return; }
+      DataBroker::Handle handle = DataBroker::resolve(key, strlen(key));
+      if (!handle.valid()) { sendError(c, F("Unknown key")); return; }
+      c.subs.emplace_back();
+      c.subs.back().key = key;
+      c.subs.back().handle = handle;
+      c.subs.back().interval = interval;
+    }
+
+    void unsubscribe(Client& c, const char* key) {
+      c.subs.erase(
+        std::remove_if(c.subs.begin(), c.subs.end(), [key](const Subscription& s) { return s.key == key; }),
+        c.subs.end());
+    }
+
+    void handleMessage(Client& c, const char* text, size_t length) {
+      StaticJsonDocument<384> doc;
+      if (deserializeJson(doc, text, length)) { sendError(c, F("Malformed message")); return; }
+
+      uint32_t interval = std::max(doc[F("ms")] | DefaultInterval, MinInterval);
+      for (JsonVariantConst key : doc[F("unsub")].as<JsonArrayConst>()) {
+        if (key.is<const char*>()) unsubscribe(c, key.as<const char*>());
+      }
+      for (JsonVariantConst key : doc[F("sub")].as<JsonArrayConst>()) {
+        if (key.is<const char*>()) subscribe(c, key.as<const char*>(), interval);
+      }
+    }
+
+    // Handle the frame at the start of the receive buffer, if it is complete
+    // @return true if a frame was consumed and the client is still connected
+    bool processFrame(Client& c) {
+      if (c.rxLength < 2) return false;
+      bool fin = c.rx[0] & 0x80;
+      uint8_t opcode = c.rx[0] & 0x0F;
+      bool masked = c.rx[1] & 0x80;
+      size_t length = c.rx[1] & 0x7F;
+      size_t offset = 2;
+      if (length == 126) {
+        if (c.rxLength < 4) return false;
+        length = (c.rx[2] << 8) | c.rx[3];
+        offset = 4;
+      } else if (length == 127) {
+        close(c, TooBig); return false;
+      }
+      if (!fin || !masked) { close(c, ProtocolError); return false; }
+      size_t frameLength = offset + 4 + length;
+      if (frameLength > sizeof(c.rx)) { close(c, TooBig); return false; }
+      if (c.rxLength < frameLength) return false;
+
+      const uint8_t* mask = &c.rx[offset];
+      char* payload = (char*)&c.rx[offset + 4];
+      for (size_t i = 0; i < length; i++) payload[i] ^= mask[i % 4];
+
+      switch (opcode) {
+        case Text: handleMessage(c, payload, length); break;
+        case Ping: sendFrame(c, Pong, payload, length); break;
+        case Pong: break;
+        case Close: close(c, Normal); return false;
+        default: close(c, Unsupported); return false;
+      }
+      if (!c.active) return false;
+
+      memmove(c.rx, c.rx + frameLength, c.rxLength - frameLength);
+      c.rxLength -= frameLength;
+      return true;
+    }
+
+    //
+    // ----- Pushing changed values
+    //
+
+    void pushChanges(Client& c, uint32_t now) {
+#if defined(ESP8266)
+      // Don't consume changes that couldn't be sent without blocking
+      if ((size_t)c.client.availableForWrite() < MaxMessage) return;
+#endif
+      StreamString message;
+      for (Subscription& s : c.subs) {
+        uint32_t wait = s.changed ? MinInterval : s.interval;
+        if (s.sent && now - s.lastChecked < wait) continue;
+        s.lastChecked = now;
+        s.changed = false;
+
+        String value;
+        DataBroker::map(s.handle, value);
+        uint32_t hash = WTKeyHash::of(value);
+        if (s.sent && hash == s.hash) continue;
+        s.hash = hash;
+        s.sent = true;
+
+        message.print(message.length() ? ',' : '{');
+        WTJson::writeString(message, s.key.c_str(), s.key.length());
+        message.print(':');
+        WTJson::writeString(message, value.c_str(), value.length());
+      }
+      if (message.length() == 0) return;
+      message.print('}');
+      sendFrame(c, Text, message.c_str(), message.length());
+    }
+
+    void noteChanges(const DataBroker::Handle* changed, size_t count) {
+      for (Client& c : clients) {
+        if (!c.active) continue;
+        for (Subscription& s : c.subs) {
+          for (size_t i = 0; i < count; i++) {
+            if (changed[i].mapper == s.handle.mapper && changed[i].id == s.handle.id) s.changed = true;
+          }
+        }
+      }
+    }
+
+    //
+    // ----- Public functions
+    //
+
+    void begin(uint16_t port) {
+      if (listener) return;
+      listener = new WiFiServer(port);
+      listener->begin();
+      DataBroker::subscribe(noteChanges);
+      Log.notice(F("DataChannel: Listening on port %d"), port);
+    }
+
+    void maintain() {
+      if (!listener) return;
+      if (listener->hasClient()) accept(listener->available());
+
+      uint32_t now = millis();
+      for (Client& c : clients) {
+        if (!c.active) continue;
+        if (!c.client.connected()) { drop(c); continue; }
+        if (!c.upgraded) { readHandshake(c, now); continue; }
+
+        int available;
+        while ((available = c.client.available()) > 0 && c.rxLength < sizeof(c.rx)) {
+          size_t n = std::min((size_t)available, sizeof(c.rx) - c.rxLength);
+          int got = c.client.read(c.rx + c.rxLength, n);
+          if (got <= 0) break;
+          c.rxLength += got;
+        }
+        while (processFrame(c)) { }
+        if (c.active) pushChanges(c, now);
+      }
+    }
+
+  } // ----- END: WebUI::DataChannel
+} // ----- END: WebUI
@@ -10,11 +10,14 @@
 
 //--------------- Begin:  Includes ---------------------------------------------
 //                                  Core Libraries
+#include <StreamString.h>
 //                                  Third Party Libraries
 #include <ArduinoLog.h>
 #include <BPABasics.h>
 //                                  Local Includes
 #include "DataBroker.h"
+#include "WTBufferedWriter.h"
+#include "WTJson.h"
 #include "WebThing.h"
 #include "WebUI.h"
 //--------------- End:    Includes ---------------------------------------------
@@ -31,6 +34,10 @@ namespace WebUI {
 
     std::vector<ButtonDesc> buttonActions;
 
+    const char LogLevelOptions[] PROGMEM =
+      "0|(0) SILENT\n1|(1) FATAL\n2|(2) ERROR\n3|(3) WARNING\n"
+      "4|(4) NOTICE\n5|(5) TRACE\n6|(6) VERBOSE";
+
     void reboot() {
       if (!authenticationOK()) { return; }
       redirectHome();
@@ -49,6 +56,101 @@ namespace WebUI {
       WebUI::wrapWebAction("/dev/data", action);
     }
 
+    // Write the value of h as JSON, or null if h is invalid
+    void writeJSONValue(Print& out, DataBroker::Handle h) {
+      static DataBroker::Value value;   // Reused so its buffer is only allocated once
+      DataBroker::get(h, value);
+      switch (value.type) {
+        case DataBroker::Value::Type::Int: out.print(value.i); break;
+        case DataBroker::Value::Type::Float:
+          if (isnan(value.f) || isinf(value.f)) out.print(F("null"));
+          else out.print(value.f, value.decimals);
+          break;
+        case DataBroker::Value::Type::Bool: out.print(value.b ? F("true") : F("false")); break;
+        case DataBroker::Value::Type::Text: WTJson::writeString(out, value.text, value.length); break;
+        default: out.print(F("null")); break;
+      }
+    }
+
+    // Write "$P.subkey":value as a member of a JSON object
+    void writeValue(Print& out, bool& first, char prefix, const char* subkey, size_t length, DataBroker::Handle h) {
+      out.print(first ? F("{\"$") : F(",\"$"));
+      first = false;
+      out.print(prefix); out.print('.');
+      out.write(subkey, length);
+      out.print(F("\":"));
+      writeJSONValue(out, h);
+    }
+
+    // As above, for a key as it was given in a request, which may be malformed
+    void writeValue(Print& out, bool& first, const char* key, size_t length, DataBroker::Handle h) {
+      out.print(first ? '{' : ',');
+      first = false;
+      String name = "$";
+      name.reserve(length + 1);
+      for (size_t i = 0; i < length; i++) name += key[i];
+      WTJson::writeString(out, name.c_str(), name.length());
+      out.print(':');
+      writeJSONValue(out, h);
+    }
+
+    // Send the values of many DataBroker keys as a single JSON object:
+    //    /api/data?keys=S.heap,W.temp    The listed keys ('$' is optional)
+    //    /api/data?prefix=W              Every key in the W namespace
+    //    /api/data                       Every key that can be enumerated
+    // Listed keys that are malformed or unknown have the value null.
+    void sendDataValues() {
+      auto action = []() {
+        String keys = arg(F("keys"));
+        String prefix = arg(F("prefix"));
+
+        auto cp = [&keys, &prefix](Stream& s) {
+          WTPrintWriter<512> out(s);
+          bool first = true;
+          if (keys.length()) {
+            char key[64] = "$";
+            for (unsigned int start = 0; start < keys.length(); ) {
+              int comma = keys.indexOf(',', start);
+              unsigned int end = (comma < 0) ? keys.length() : comma;
+              const char* token = keys.c_str() + start;
+              size_t length = end - start;
+              start = end + 1;
+              if (length == 0) continue;    // e.g. a trailing comma
+              if (*token == '$') { token++; length--; }
+
+              DataBroker::Handle h;
+              if (length >= 3 && token[1] == '.' && length < sizeof(key) - 1) {
+                memcpy(key + 1, token, length);
+                h = DataBroker::resolve(key, length + 1);
+              }
+              writeValue(out, first, token, length, h);
+            }
+          } else {
+            auto visit = [&out, &first](char p, const char* subkey, DataBroker::Handle h) {
+              writeValue(out, first, p, subkey, strlen(subkey), h);
+            };
+            DataBroker::enumerate(prefix.length() ? prefix[0] : 0, visit);
+          }
+          out.print(first ? F("{}") : F("}"));
+          out.flush();
+        };
+        sendArbitraryContent("application/json", -1, cp);
+      };
+
+      WebUI::wrapWebAction("/api/data", action, false);
+    }
+
+    void sendMetrics() {
+      auto action = []() {
+        StreamString json;
+        metrics().toJSON(json);
+        sendStringContent("application/json", json);
+        if (hasArg(F("reset"))) metrics().reset();
+      };
+
+      WebUI::wrapWebAction("/dev/metrics", action, false);
+    }
+
     void updateSettings() {
       auto action = []() {
         WebThing::settings.showDevMenu = hasArg("showDevMenu");
@@ -87,16 +189,22 @@ namespace WebUI {
     }
 
     void displayDevPage() {
-      String llTarget = "SL" + String(WebThing::settings.logLevel);
-
-      auto mapper =[&llTarget](const String &key, String& val) -> void {
-        if (key == "SHOW_DEV_MENU") val = checkedOrNot[WebThing::settings.showDevMenu];
-        else if (key.equals(F("HEAP"))) { DataBroker::map("$S.heap", val); }
-        else if (key == "BUTTONS") concatDevButtons(val);
-        else if (key == llTarget) val = "selected";
+      auto mapper =[](WTKeyHash::Hash keyHash, const String &key, String& val) -> void {
+        switch (keyHash) {
+          case "SHOW_DEV_MENU"_kh: val = checkedOrNot[WebThing::settings.showDevMenu]; break;
+          case "HEAP"_kh: {
+            static const DataBroker::Handle heap = DataBroker::resolve("$S.heap");
+            DataBroker::map(heap, val);
+            break;
+          }
+          case "BUTTONS"_kh: concatDevButtons(val); break;
+          case "LOG_LEVEL_OPTIONS"_kh:
+            sendOptions(FPSTR(LogLevelOptions), String(WebThing::settings.logLevel));
+            break;
+        }
       };
 
-      WebUI::wrapWebPage("/displayDevPage", "/wt/DevPage.html", mapper);
+      WebUI::wrapCachedWebPage("/displayDevPage", "/wt/DevPage.html", mapper, {"HEAP"_kh});
     }
 
     void init() {
@@ -111,10 +219,13 @@ namespace WebUI {
       registerHandler("/dev/reboot",          reboot);
       registerHandler("/dev/updateSettings",  updateSettings);
       registerHandler("/dev/data",            getDataBrokerValue);
+      registerHandler("/dev/metrics",         sendMetrics);
+      registerHandler("/api/data",            sendDataValues);
     }
 
     void addButton(ButtonDesc&& buttonAction) {
       buttonActions.push_back(buttonAction);
+      BaseSettings::changed();  // The dev page must be rendered again
     }
 
   } // ----- END: WebUI::Dev
@@ -0,0 +1,124 @@
+/*
+ * WebUIEvents:
+ *    A Server-Sent Events stream at /events. Managers publish new readings
+ *    as they produce them and each subscriber receives them on a single
+ *    long-lived connection rather than re-requesting whole pages.
+ *
+ * NOTES:
+ * o An event is formatted once and the same bytes are written to every
+ *   subscriber.
+ * o A subscriber that can't accept an event without blocking misses that
+ *   event rather than stalling loop().
+ *
+ */
+
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+//                                  Third Party Libraries
+#include <ArduinoLog.h>
+//                                  Local Includes
+#include "WebUI.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+
+// ----- BEGIN: WebUI namespace
+namespace WebUI {
+  extern WebServer* server;
+
+  namespace Events {
+    struct Subscriber {
+      WiFiClient client;
+      uint32_t lastSent = 0;
+      bool active = false;    // The client holds a connection that must be released
+    };
+    Subscriber subscribers[MaxSubscribers];
+
+    void drop(Subscriber& s) {
+      Log.verbose(F("Events: Dropping %s"), s.client.remoteIP().toString().c_str());
+      s.client.stop();
+      s.client = WiFiClient();
+      s.active = false;
+    }
+
+    void send(Subscriber& s, const char* message, size_t length) {
+#if defined(ESP8266)
+      if ((size_t)s.client.availableForWrite() < length) return;
+#endif
+      if (s.client.write((const uint8_t*)message, length) != length) { drop(s); return; }
+      s.lastSent = millis();
+    }
+
+    void subscribe() {
+      if (!authenticationOK()) { return; }
+
+      Subscriber* slot = nullptr;
+      for (Subscriber& s : subscribers) {
+        if (!s.active) { slot = &s; break; }
+      }
+      if (!slot) {
+        closeConnection(503, "Too many event subscribers");
+        return;
+      }
+
+      slot->client = server->client();
+      slot->client.setNoDelay(true);
+      slot->client.print(F(
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: text/event-stream\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: keep-alive\r\n"
+        "\r\n"
+        "retry: 5000\n\n"));
+      slot->lastSent = millis();
+      slot->active = true;
+      Log.verbose(F("Events: New subscriber %s"), slot->client.remoteIP().toString().c_str());
+    }
+
+    void init() {
+      registerHandler("/events", HTTP_GET, subscribe);
+    }
+
+    void publish(const char* event, const String& data) {
+      if (!hasSubscribers()) return;
+
+      String message;
+      message.reserve(data.length() + strlen(event) + 16);
+      message = F("event: ");
+      message += event;
+      message += F("\ndata: ");
+      message += data;
+      message += F("\n\n");
+
+      for (Subscriber& s : subscribers) {
+        if (s.active) send(s, message.c_str(), message.length());
+      }
+    }
+
+    void publish(const char* event, const JsonDocument& doc) {
+      if (!hasSubscribers()) return;
+      String data;
+      serializeJson(doc, data);
+      publish(event, data);
+    }
+
+    bool hasSubscribers() {
+      for (Subscriber& s : subscribers) {
+        if (s.active) return true;
+      }
+      return false;
+    }
+
+    void maintain() {
+      static const char KeepAlive[] = ":\n\n";
+      uint32_t now = millis();
+      for (Subscriber& s : subscribers) {
+        if (!s.active) continue;
+        if (!s.client.connected()) drop(s);
+        else if (now - s.lastSent > KeepAliveInterval) send(s, KeepAlive, sizeof(KeepAlive) - 1);
+      }
+    }
+
+  } // ----- END: WebUI::Events
+} // ----- END: WebUI
@@ -0,0 +1,363 @@
+/*
+ * WebUISettingsAPI:
+ *    A JSON API for reading and updating settings. Intended for tools that
+ *    provision many devices rather than for people using a browser:
+ *      GET   /api/settings          The WebThing settings as a JSON object
+ *      PATCH /api/settings          Update the WebThing settings named in the body
+ *      GET   /api/settings/{name}   The same for settings registered using add()
+ *      PATCH /api/settings/{name}
+ *
+ * NOTES:
+ * o Neither direction builds a JsonDocument. Responses are written field by
+ *   field (see BaseSerializer::visitFields) through a small buffer, and
+ *   request bodies are scanned in place.
+ * o A PATCH body must be a flat JSON object. The whole body is checked
+ *   before any field is changed, so a bad request changes nothing. Integers
+ *   outside the range of their field are rejected rather than wrapped.
+ * o Secret fields (e.g. webPassword) may be set but are never reported.
+ *
+ */
+
+
+//--------------- Begin:  Includes ---------------------------------------------
+//                                  Core Libraries
+#include <algorithm>
+#include <climits>
+#include <errno.h>
+#include <vector>
+//                                  Third Party Libraries
+#include <ArduinoLog.h>
+//                                  Local Includes
+#include "WTBufferedWriter.h"
+#include "WTJson.h"
+#include "WebThing.h"
+#include "WebUI.h"
+//--------------- End:    Includes ---------------------------------------------
+
+
+
+// ----- BEGIN: WebUI namespace
+namespace WebUI {
+
+  namespace SettingsAPI {
+    struct Registration {
+      String name;
+      BaseSettings* settings;
+      std::function<void(void)> onChange;
+    };
+    std::vector<Registration> registered;
+
+    const String BadRequest = "400 Bad Request";
+    const String NotFound = "404 Not Found";
+
+    //
+    // ----- Writing settings as JSON
+    //
+
+    class JSONFieldWriter : public FieldVisitor {
+    public:
+      JSONFieldWriter(Print& theOut) : out(theOut) { }
+
+      void visit(const __FlashStringHelper* name, bool& value) override {
+        writeName(name); out.print(value ? F("true") : F("false"));
+      }
+      void visit(const __FlashStringHelper* name, long& value) override {
+        writeName(name); out.print(value);
+      }
+      void visit(const __FlashStringHelper* name, float& value) override {
+        writeName(name);
+        if (isnan(value) || isinf(value)) out.print(F("null"));
+        else out.print(value, 6);
+      }
+      void visit(const __FlashStringHelper* name, String& value) override {
+        writeName(name); WTJson::writeString(out, value.c_str());
+      }
+      void visitSecret(const __FlashStringHelper*, String&) override { }
+
+      void end() { out.print(first ? F("{}") : F("}")); }
+
+    private:
+      void writeName(const __FlashStringHelper* name) {
+        out.print(first ? '{' : ',');
+        first = false;
+        out.print('"'); out.print(name); out.print(F("\":"));
+      }
+
+      Print& out;
+      bool first = true;
+    };
+
+    // Used to find the length of a response before sending it
+    class CountingPrint : public Print {
+    public:
+      size_t write(uint8_t) override { count++; return 1; }
+      size_t write(const uint8_t*, size_t size) override { count += size; return size; }
+      size_t count = 0;
+    };
+
+    void sendSettings(BaseSettings* settings, const String& code = OKReponse) {
+      CountingPrint counter;
+      JSONFieldWriter measure(counter);
+      settings->visitFields(measure);
+      measure.end();
+
+      auto cp = [settings](Stream& s) {
+        WTPrintWriter<256> buffered(s);
+        JSONFieldWriter writer(buffered);
+        settings->visitFields(writer);
+        writer.end();
+        buffered.flush();
+      };
+      sendArbitraryContent("application/json", counter.count, cp, code);
+    }
+
+    class StringPrint : public Print {
+    public:
+      StringPrint(String& theString) : string(theString) { }
+      size_t write(uint8_t c) override { string.concat((char)c); return 1; }
+      String& string;
+    };
+
+    void sendError(const String& code, const String& message) {
+      String body = F("{\"error\":");
+      StringPrint out(body);
+      WTJson::writeString(out, message.c_str());
+      body.concat('}');
+      Log.warning(F("Settings API: %s"), message.c_str());
+      sendStringContent("application/json", body, code);
+    }
+
+    //
+    // ----- Reading settings from JSON
+    //
+
+    // Scans the members of a flat JSON object in place, one at a time
+    class FlatJSONReader {
+    public:
+      enum class Kind {String, Number, True, False, Null};
+
+      FlatJSONReader(const char* json) : p(json) { }
+
+      // Scan the next member of the object into name, kind, and text
+      // @return false at the end of the object or if the JSON is malformed
+      bool next() {
+        if (done) return false;
+        skipSpace();
+        if (!started) {
+          if (*p != '{') return fail();
+          p++; skipSpace();
+          started = true;
+          if (*p == '}') return finish();
+        } else {
+          if (*p == '}') return finish();
+          if (*p != ',') return fail();
+          p++; skipSpace();
+        }
+
+        if (!readString(name)) return fail();
+        skipSpace();
+        if (*p != ':') return fail();
+        p++; skipSpace();
+
+        if (*p == '"') {
+          kind = Kind::String;
+          return readString(text) || fail();
+        }
+        if (literal(PSTR("true"))) { kind = Kind::True; return true; }
+        if (literal(PSTR("false"))) { kind = Kind::False; return true; }
+        if (literal(PSTR("null"))) { kind = Kind::Null; return true; }
+
+        kind = Kind::Number;
+        text = "";
+        while (isdigit(*p) || *p == '-' || *p == '+' || *p == '.' || *p == 'e' || *p == 'E') {
+          text.concat(*p++);
+        }
+        return text.length() || fail();
+      }
+
+      bool failed() const { return _failed; }
+
+      String name;
+      Kind kind;
+      String text;    // The value of a string or the text of a number
+
+    private:
+      void skipSpace() { while (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n') p++; }
+
+      bool fail() { _failed = done = true; return false; }
+
+      bool finish() {
+        p++; skipSpace();
+        done = true;
+        if (*p) _failed = true;   // Nothing may follow the object
+        return false;
+      }
+
+      bool literal(PGM_P word) {
+        size_t length = strlen_P(word);
+        if (strncmp_P(p, word, length) != 0) return false;
+        p += length;
+        return true;
+      }
+
+      bool readString(String& s) {
+        if (*p != '"') return false;
+        p++;
+        s = "";
+        while (*p != '"') {
+          char c = *p++;
+          if (c == 0) return false;
+          if (c == '\\') {
+            c = *p++;
+            switch (c) {
+              case 'b': c = '\b'; break;
+              case 'f': c = '\f'; break;
+              case 'n': c = '\n'; break;
+              case 'r': c = '\r'; break;
+              case 't': c = '\t'; break;
+              case 'u': {
+                char hex[5] = {0};
+                for (int i = 0; i < 4; i++) { if (!isxdigit(*p)) return false; hex[i] = *p++; }
+                uint16_t u = strtoul(hex, nullptr, 16);
+                if (u >= 0x800) {
+                  s.concat((char)(0xE0 | (u >> 12)));
+                  s.concat((char)(0x80 | ((u >> 6) & 0x3F)));
+                  c = (char)(0x80 | (u & 0x3F));
+                } else if (u >= 0x80) {
+                  s.concat((char)(0xC0 | (u >> 6)));
+                  c = (char)(0x80 | (u & 0x3F));
+                } else c = (char)u;
+                break;
+              }
+              case '"': case '\\': case '/': break;
+              default: return false;
+            }
+          }
+          s.concat(c);
+        }
+        p++;
+        return true;
+      }
+
+      const char* p;
+      bool started = false;
+      bool done = false;
+      bool _failed = false;
+    };
+
+    // Finds the field named by the current member of a reader and, if
+    // asked, assigns the member's value to it
+    class FieldSetter : public FieldVisitor {
+    public:
+      FieldSetter(const FlatJSONReader& theMember, bool shouldAssign) :
+        member(theMember), assign(shouldAssign) { }
+
+      void visit(const __FlashStringHelper* name, bool& value) override {
+        if (!matches(name)) return;
+        bool isBool = member.kind == Kind::True || member.kind == Kind::False;
+        if (!isBool) wrongType = true;
+        else if (assign) value = (member.kind == Kind::True);
+      }
+      void visit(const __FlashStringHelper* name, long& value) override {
+        visit(name, value, LONG_MIN, LONG_MAX);
+      }
+      void visit(const __FlashStringHelper* name, long& value, long min, long max) override {
+        if (!matches(name)) return;
+        char* end = nullptr;
+        errno = 0;
+        long l = (member.kind == Kind::Number) ? strtol(member.text.c_str(), &end, 10) : 0;
+        if (!end || *end) wrongType = true;
+        else if (errno == ERANGE || l < min || l > max) outOfRange = true;
+        else if (assign) value = l;
+      }
+      void visit(const __FlashStringHelper* name, float& value) override {
+        if (!matches(name)) return;
+        char* end = nullptr;
+        float f = (member.kind == Kind::Number) ? strtod(member.text.c_str(), &end) : 0;
+        if (!end || *end) wrongType = true;
+        else if (assign) value = f;
+      }
+      void visit(const __FlashStringHelper* name, String& value) override {
+        if (!matches(name)) return;
+        if (member.kind != Kind::String) wrongType = true;
+        else if (assign) value = member.text;
+      }
+
+      bool found = false;
+      bool wrongType = false;
+      bool outOfRange = false;
+
+    private:
+      using Kind = FlatJSONReader::Kind;
+
+      bool matches(const __FlashStringHelper* name) {
+        if (found || strcmp_P(member.name.c_str(), (PGM_P)name) != 0) return false;
+        return (found = true);
+      }
+
+      const FlatJSONReader& member;
+      bool assign;
+    };
+
+    void updateSettings(BaseSettings* settings, std::function<void(void)> onChange) {
+      const String body = WebUI::arg("plain");
+
+      // The first pass only checks the body so that a bad request changes nothing
+      for (bool assign : {false, true}) {
+        FlatJSONReader reader(body.c_str());
+        while (reader.next()) {
+          FieldSetter setter(reader, assign);
+          settings->visitFields(setter);
+          if (!setter.found) return sendError(BadRequest, String(F("Unknown setting: ")) + reader.name);
+          if (setter.wrongType) return sendError(BadRequest, String(F("Wrong type for: ")) + reader.name);
+          if (setter.outOfRange) return sendError(BadRequest, String(F("Out of range: ")) + reader.name);
+        }
+        if (reader.failed()) return sendError(BadRequest, F("Expected a flat JSON object"));
+      }
+
+      settings->write();
+      if (onChange) onChange();
+      sendSettings(settings);
+    }
+
+    //
+    // ----- Endpoints
+    //
+
+    void handle(const char* actionName, bool update) {
+      auto action = [update]() {
+        BaseSettings* settings = &WebThing::settings;
+        std::function<void(void)> onChange = []() {
+          Log.setLevel(WebThing::settings.logLevel);
+          WebThing::Protected::configChanged();
+        };
+
+        String name = pathArg("name");
+        if (name.length()) {
+          auto r = std::find_if(registered.begin(), registered.end(),
+              [&name](const Registration& r) { return r.name == name; });
+          if (r == registered.end()) return sendError(NotFound, String(F("No settings named: ")) + name);
+          settings = r->settings;
+          onChange = r->onChange;
+        }
+
+        if (update) updateSettings(settings, onChange);
+        else sendSettings(settings);
+      };
+
+      wrapWebAction(actionName, action, update);
+    }
+
+    void init() {
+      registerHandler("/api/settings",        HTTP_GET,   []() { handle("GET /api/settings", false); });
+      registerHandler("/api/settings",        HTTP_PATCH, []() { handle("PATCH /api/settings", true); });
+      registerHandler("/api/settings/{name}", HTTP_GET,   []() { handle("GET /api/settings/{name}", false); });
+      registerHandler("/api/settings/{name}", HTTP_PATCH, []() { handle("PATCH /api/settings/{name}", true); });
+    }
+
+    void add(const String& name, BaseSettings* settings, std::function<void(void)> onChange) {
+      registered.push_back({name, settings, onChange});
+    }
+
+  } // ----- END: WebUI::SettingsAPI
+} // ----- END: WebUI
@@ -15,6 +15,7 @@
 #include <BPABasics.h>
 //                                  WebThing Includes
 #include <WebThing.h>
+#include <WebUI.h>
 //                                  Local Includes
 #include "AQIMgr.h"
 //--------------- End:    Includes ---------------------------------------------
@@ -142,6 +143,7 @@ void AQIMgr::takeNoteOfNewData(AQIReadings& newSample) {
   readings.timestamp =  Basics::wallClockFromMillis(newSample.timestamp) - WebThing::getGMTOffset();
   readings.aqi = derivedAQI(newSample.env.pm25);
   historyBufferIsDirty |= buffers.conditionalPushAll(readings);
+  publishReadings(newSample, readings.aqi);
 
   // 2. If it has been an appropriate period of time, save the history to a file
   static const uint32_t WriteThreshold = 10 * 60 * 1000L; // Write every 10 Minutes
@@ -153,6 +155,17 @@ void AQIMgr::takeNoteOfNewData(AQIReadings& newSample) {
   }
 }
 
+void AQIMgr::publishReadings(const AQIReadings& sample, uint16_t derived) {
+  if (!WebUI::Events::hasSubscribers()) return;
+  StaticJsonDocument<128> doc;
+  doc["ts"] = sample.timestamp;
+  doc["aqi"] = derived;
+  doc["pm10"] = sample.env.pm10;
+  doc["pm25"] = sample.env.pm25;
+  doc["pm100"] = sample.env.pm100;
+  WebUI::Events::publish("aqi", doc);
+}
+
 void AQIMgr::emitHistoryAsJson(HistoryRange r, Stream& s) {
   buffers[r].store(s);
 }
@@ -130,6 +130,7 @@ private:
   // ----- Methods -----
   void enterState(State);
   void takeNoteOfNewData(AQIReadings& newSample);
+  void publishReadings(const AQIReadings& sample, uint16_t derived);
 
   // --- Utility Functions ---
   void logData(AQIReadings& data);
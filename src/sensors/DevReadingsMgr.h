@@ -8,6 +8,7 @@
 #include <BPABasics.h>
 #include <GenericESP.h>
 //                                  WebThing Includes
+#include <WebUI.h>
 //                                  Local Includes
 #include "DeviceReadings.h"
 //--------------- End:    Includes ---------------------------------------------
@@ -26,10 +27,22 @@ public:
       latestReadings.heap.maxFreeBlock = GenericESP::getMaxFreeBlockSize();
       latestReadings.timestamp = millis();
       _timestampOfNextReading = latestReadings.timestamp + TimeBetweenReads;
+      publishReadings();
     }
   }
 
 private:
+  void publishReadings() {
+    if (!WebUI::Events::hasSubscribers()) return;
+    StaticJsonDocument<128> doc;
+    doc["ts"] = latestReadings.timestamp;
+    doc["voltage"] = latestReadings.voltage;
+    doc["heap"] = latestReadings.heap.free;
+    doc["frag"] = latestReadings.heap.frag;
+    doc["maxFreeBlock"] = latestReadings.heap.maxFreeBlock;
+    WebUI::Events::publish("device", doc);
+  }
+
   static constexpr const uint32_t TimeBetweenReads = Basics::minutesToMS(10);
   uint32_t _timestampOfNextReading = 0;
 };
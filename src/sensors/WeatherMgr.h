@@ -16,6 +16,7 @@
 #include <HistoryBuffers.h>
 //                                  WebThing Includes
 #include <WebThing.h>
+#include <WebUI.h>
 //                                  Local Includes
 #include "BMESensor.h"
 #include "WeatherReadings.h"
@@ -150,6 +151,7 @@ public:
     WeatherSensor::calculateDerivedValues(lastReadings, _elevation);
     lastReadings.timestamp = curMillis;
     nextReading = curMillis + _readingInterval;
+    publishReadings();
 
     // 2. Push the reading into the appropriate set of history buffers (if any)
     SavedReadings readings(Basics::wallClockFromMillis(lastReadings.timestamp) - WebThing::getGMTOffset());
@@ -181,6 +183,18 @@ private:
   // ----- Types -----
 
 
+  // ----- Member Functions -----
+  void publishReadings() {
+    if (!WebUI::Events::hasSubscribers()) return;
+    StaticJsonDocument<128> doc;
+    doc["ts"] = lastReadings.timestamp;
+    doc["temp"] = lastReadings.temp;
+    doc["humidity"] = lastReadings.humidity;
+    doc["pressure"] = lastReadings.pressure;
+    doc["heatIndex"] = lastReadings.heatIndex;
+    WebUI::Events::publish("weather", doc);
+  }
+
   // ----- Data Members -----
   std::vector<WeatherSensor*> _sensors;
   float _tempCorrection;
@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+# compress_assets.sh:
+#    Produce precompressed (.gz) variants of the static assets in a data
+#    directory. WebUI::registerStatic() serves <file>.gz in place of <file>
+#    to any client that accepts gzip encoding.
+#
+# USAGE:
+#    tools/compress_assets.sh [directory]
+#    The directory defaults to data/wt
+#
+# NOTES:
+# o HTML files are skipped by default since WebThing's HTML files are
+#   templates that are processed on the device. Pass additional extensions
+#   in the EXTENSIONS environment variable to override the default list.
+# o A .gz variant is only kept if it is at least 10% smaller than the original.
+#   Already compressed formats (e.g. most .png files) usually don't qualify.
+# o Run this before uploading the data directory to the device.
+#
+
+DIR="${1:-data/wt}"
+EXTENSIONS="${EXTENSIONS:-ico png css js svg json txt}"
+
+if [ ! -d "$DIR" ]; then
+  echo "compress_assets: $DIR is not a directory" >&2
+  exit 1
+fi
+
+for ext in $EXTENSIONS; do
+  find "$DIR" -type f -name "*.$ext" | while read -r file; do
+    gzip -9 -n -c "$file" > "$file.gz"
+    original=$(wc -c < "$file")
+    compressed=$(wc -c < "$file.gz")
+    if [ $((compressed * 10)) -lt $((original * 9)) ]; then
+      echo "$file: $original -> $compressed bytes"
+    else
+      echo "$file: too little benefit from compression, skipping"
+      rm -f "$file.gz"
+    fi
+  done
+done